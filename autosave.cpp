@@ -0,0 +1,283 @@
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <QTimer>
+
+#include "autosave.h"
+#include "project_file.h"
+
+
+/** how often the timer looks for a checkpoint being due, in ms */
+static const int POLL_INTERVAL = 1000;
+
+/** the journal is started over once it's this many times the size it
+ *  was with just one checkpoint in it */
+static const int RESTART_FACTOR = 4;
+
+/**
+ * @brief journalDir - Where the recovery journals are kept
+ *
+ */
+static QString journalDir()
+{
+    QString dir = QStandardPaths::writableLocation(
+                QStandardPaths::AppLocalDataLocation) + "/recovery";
+    QDir().mkpath(dir);
+    return dir;
+}
+
+/**
+ * @brief AutoSaver::AutoSaver - Each session has a journal of its own,
+ *                               named after its process and start time, and
+ *                               holds its lock for as long as it runs. The
+ *                               journal isn't created until the first
+ *                               checkpoint.
+ *
+ */
+AutoSaver::AutoSaver(QObject *parent)
+    : QObject(parent)
+{
+    changes = 0;
+    journal = 0;
+    restartSize = 0;
+    checkpoints = 0;
+    totalTime = 0;
+    totalBytes = 0;
+    sinceCheckpoint.start();
+    running.start();
+
+    path = QString("%1/%2-%3.paint").arg(journalDir())
+            .arg(QCoreApplication::applicationPid())
+            .arg(QDateTime::currentMSecsSinceEpoch());
+    lock = new QLockFile(path + ".lock");
+    if(!lock->tryLock(0))
+        last.error = tr("The recovery journal couldn't be locked, so "
+                        "autosave is off.");
+
+    watcher = new QFutureWatcher<Cost>(this);
+    connect(watcher, SIGNAL(finished()), this, SLOT(OnCheckpointDone()));
+
+    timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), this, SLOT(OnTimer()));
+    if(lock->isLocked())
+        timer->start(POLL_INTERVAL);
+}
+
+/**
+ * @brief AutoSaver::~AutoSaver - Closing normally, so there's nothing to
+ *                                recover next time
+ *
+ */
+AutoSaver::~AutoSaver()
+{
+    watcher->waitForFinished();
+    delete journal;
+    if(lock->isLocked())
+    {
+        QFile::remove(path);
+        lock->unlock();
+    }
+    delete lock;
+}
+
+/**
+ * @brief AutoSaver::orphanedJournals - The journals no running session
+ *                                      holds the lock of, left behind by
+ *                                      sessions that crashed; newest first
+ *
+ */
+QStringList AutoSaver::orphanedJournals()
+{
+    QFileInfoList found = QDir(journalDir()).entryInfoList(
+                QStringList() << "*.paint", QDir::Files, QDir::Time);
+
+    QStringList orphans;
+    for(int i = 0; i < found.size(); ++i)
+    {
+        // a lock is only stale once its process is gone, however old
+        QLockFile owner(found.at(i).absoluteFilePath() + ".lock");
+        owner.setStaleLockTime(0);
+        if(owner.tryLock(0))
+        {
+            owner.unlock();
+            orphans.append(found.at(i).absoluteFilePath());
+        }
+    }
+    return orphans;
+}
+
+/**
+ * @brief AutoSaver::recover - The image of the last checkpoint in a
+ *                             journal, or a null canvas and the reason if
+ *                             it can't be read
+ *
+ */
+Canvas AutoSaver::recover(const QString &journal, QString *error)
+{
+    ProjectFile file(journal);
+    Canvas canvas;
+    if(file.open())
+    {
+        QByteArray state = file.state();
+        QDataStream in(state);
+        in.setVersion(QDataStream::Qt_5_0);
+        canvas = file.readCanvas(in);
+        if(canvas.isNull() && error)
+            *error = tr("The image in the recovery journal can't be read.");
+    }
+    else if(error)
+        *error = file.errorString();
+    return canvas;
+}
+
+void AutoSaver::discard(const QString &journal)
+{
+    QFile::remove(journal);
+}
+
+/**
+ * @brief AutoSaver::imageChanged - Counts an edit, and asks for a
+ *                                  checkpoint straight away after enough
+ *
+ */
+void AutoSaver::imageChanged()
+{
+    ++changes;
+    if(changes >= AUTOSAVE_EDITS)
+        OnTimer();
+}
+
+/**
+ * @brief AutoSaver::OnTimer - Asks for a checkpoint if there were edits
+ *                             since the last one, enough of them or long
+ *                             enough ago, and the budgets allow it
+ *
+ */
+void AutoSaver::OnTimer()
+{
+    if(changes == 0 || watcher->isRunning() || !withinBudget() ||
+       !lock->isLocked())
+        return;
+
+    if(changes >= AUTOSAVE_EDITS ||
+       sinceCheckpoint.elapsed() >= AUTOSAVE_INTERVAL * 1000)
+        emit checkpointDue();
+}
+
+/**
+ * @brief AutoSaver::checkpoint - Writes the image to the journal on the
+ *                                thread pool. The canvas is copied, which
+ *                                only shares its tiles, so the image can
+ *                                be drawn on meanwhile.
+ *
+ */
+void AutoSaver::checkpoint(const Canvas &canvas)
+{
+    if(watcher->isRunning() || canvas.isNull() || !lock->isLocked())
+        return;
+
+    changes = 0;
+    sinceCheckpoint.restart();
+    watcher->setFuture(QtConcurrent::run([this, canvas]() {
+        return write(canvas);
+    }));
+}
+
+/**
+ * @brief AutoSaver::OnCheckpointDone - Adds up what the checkpoint cost
+ *
+ */
+void AutoSaver::OnCheckpointDone()
+{
+    last = watcher->result();
+    if(last.error.isEmpty())
+        ++checkpoints;
+    totalTime += last.time;
+    totalBytes += last.bytes;
+}
+
+/**
+ * @brief AutoSaver::write - Appends the tiles the journal doesn't have yet
+ *                           and the image, in the same layout as a project
+ *                           with no undo history. Runs on the thread pool.
+ *
+ */
+AutoSaver::Cost AutoSaver::write(const Canvas &canvas)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Cost cost;
+
+    // a journal that has grown too far is started over
+    if(journal && journal->fileSize() > restartSize)
+    {
+        delete journal;
+        journal = 0;
+    }
+
+    bool restarted = !journal;
+    if(restarted)
+    {
+        journal = new ProjectFile(path);
+        if(!journal->create())
+        {
+            cost.error = journal->errorString();
+            delete journal;
+            journal = 0;
+            return cost;
+        }
+    }
+    qint64 before = journal->fileSize();
+
+    QByteArray state;
+    QDataStream out(&state, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    journal->writeCanvas(out, canvas);
+    out << qint32(0) << qint32(0);
+
+    if(!journal->commit(state))
+    {
+        cost.error = journal->errorString();
+        delete journal;
+        journal = 0;
+    }
+    else
+    {
+        cost.journalSize = journal->fileSize();
+        cost.bytes = cost.journalSize - before;
+        if(restarted)
+            restartSize = cost.journalSize * RESTART_FACTOR;
+    }
+
+    cost.time = timer.elapsed();
+    return cost;
+}
+
+/**
+ * @brief AutoSaver::withinBudget - Whether enough time has gone by since
+ *                                  the last checkpoint started for its
+ *                                  time and bytes to fit the budgets
+ *
+ */
+bool AutoSaver::withinBudget() const
+{
+    qint64 since = sinceCheckpoint.elapsed();
+    return since * AUTOSAVE_CPU_BUDGET >= last.time * 100 &&
+           since * AUTOSAVE_IO_BUDGET * 1024 >= last.bytes * 1000;
+}
+
+double AutoSaver::cpuUsage() const
+{
+    return 100.0 * totalTime / qMax(qint64(1), running.elapsed());
+}
+
+double AutoSaver::ioUsage() const
+{
+    return totalBytes / 1024.0 / qMax(qint64(1), running.elapsed()) * 1000;
+}
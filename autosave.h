@@ -0,0 +1,109 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QStringList>
+
+#include "canvas.h"
+
+
+class ProjectFile;
+class QLockFile;
+class QTimer;
+
+/**
+ * Keeps a recovery journal of the image: a project file that each
+ * checkpoint appends the tiles changed since the last one to, see
+ * ProjectFile. Checkpoints are written on the thread pool, one at a time,
+ * and no more often than the CPU and I/O budgets allow: the next one
+ * waits until the time since the last one started makes its cost fit.
+ * Each session keeps its own journal, locked with a QLockFile while it
+ * runs, and removes it when it closes normally; a journal no session has
+ * locked was left by a crash.
+ */
+class AutoSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AutoSaver(QObject *parent = 0);
+    ~AutoSaver();
+
+    /** the journals left by sessions that crashed, the image in one, and
+     *  removing one */
+    static QStringList orphanedJournals();
+    static Canvas recover(const QString &journal, QString *error = 0);
+    static void discard(const QString &journal);
+
+    /** an edit was made; enough of them make a checkpoint due */
+    void imageChanged();
+
+    /** start writing a checkpoint of the image */
+    void checkpoint(const Canvas &canvas);
+
+    /** statistics, of the checkpoints finished */
+    int checkpointCount() const { return checkpoints; }
+    qint64 lastCheckpointTime() const { return last.time; }
+    qint64 lastCheckpointBytes() const { return last.bytes; }
+    qint64 journalSize() const { return last.journalSize; }
+    QString lastError() const { return last.error; }
+
+    /** share of the time spent writing checkpoints (percent), and the
+     *  rate they were written at (KB/s), since startup */
+    double cpuUsage() const;
+    double ioUsage() const;
+
+signals:
+    /** a checkpoint is due and within budget; the owner of the image
+     *  answers with checkpoint() */
+    void checkpointDue();
+
+private slots:
+    void OnTimer();
+    void OnCheckpointDone();
+
+private:
+    /** what writing a checkpoint cost */
+    struct Cost
+    {
+        Cost() : time(0), bytes(0), journalSize(0) {}
+        qint64 time;
+        qint64 bytes;
+        qint64 journalSize;
+        QString error;
+    };
+
+    Cost write(const Canvas &canvas);
+    bool withinBudget() const;
+
+    QTimer* timer;
+    QFutureWatcher<Cost>* watcher;
+
+    /** edits since the last checkpoint, & time since it started */
+    int changes;
+    QElapsedTimer sinceCheckpoint;
+
+    /** this session's journal & its lock; autosave is off if the lock
+     *  couldn't be taken */
+    QString path;
+    QLockFile* lock;
+
+    /** only used by the checkpoint being written: the journal, & the size
+     *  past which it's started over rather than appended to */
+    ProjectFile* journal;
+    qint64 restartSize;
+
+    int checkpoints;
+    Cost last;
+    qint64 totalTime;
+    qint64 totalBytes;
+    QElapsedTimer running;
+
+    /** Don't allow copying */
+    AutoSaver(const AutoSaver&);
+    AutoSaver& operator=(const AutoSaver&);
+};
+
+#endif // AUTOSAVE_H
@@ -1,22 +1,52 @@
 HEADERS += \
     main_window.h \
+    autosave.h \
+    canvas.h \
     dialog_windows.h \
     commands.h \
     draw_area.h \
+    flood_fill.h \
     toolbar.h \
     tool.h \
-    constants.h
+    constants.h \
+    bmp_reader.h \
+    bmp_writer.h \
+    brush_engine.h \
+    image_diff.h \
+    mipmap.h \
+    project_file.h \
+    render_thread.h \
+    resample.h \
+    undo_journal.h
 SOURCES += main.cpp \
     main_window.cpp \
+    autosave.cpp \
+    canvas.cpp \
     commands.cpp \
     dialog_windows.cpp \
     toolbar.cpp \
     draw_area.cpp \
-    tool.cpp
+    flood_fill.cpp \
+    tool.cpp \
+    bmp_reader.cpp \
+    bmp_writer.cpp \
+    brush_engine.cpp \
+    image_diff.cpp \
+    mipmap.cpp \
+    project_file.cpp \
+    render_thread.cpp \
+    resample.cpp \
+    undo_journal.cpp
 CONFIG += qt warn_on
 CONFIG += debug
 QT = core gui
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
+
+# build with CONFIG+=avx2 to use the AVX2 image kernels
+avx2 {
+    gcc|clang: QMAKE_CXXFLAGS += -mavx2
+    msvc: QMAKE_CXXFLAGS += /arch:AVX2
+}
 
 RESOURCES += \
     icons.qrc
@@ -0,0 +1,310 @@
+#include <climits>
+
+#include <QObject>
+#include <QtConcurrent>
+#include <QtEndian>
+
+#include "bmp_reader.h"
+
+
+/** BITMAPFILEHEADER, then the start of every BITMAPINFOHEADER version */
+static const int FILE_HEADER_SIZE = 14;
+static const int INFO_HEADER_SIZE = 40;
+
+/** where the channel masks are, following a BITMAPINFOHEADER or inside
+ *  the later versions of it */
+static const int MASKS_OFFSET = FILE_HEADER_SIZE + INFO_HEADER_SIZE;
+
+/** compression types */
+static const quint32 BI_RGB = 0;
+static const quint32 BI_BITFIELDS = 3;
+static const quint32 BI_ALPHABITFIELDS = 6;
+
+/**
+ * @brief channelShift - Where an 8-bit channel sits in a 32-bit pixel,
+ *                       or -1 if the mask isn't one byte
+ *
+ */
+static int channelShift(quint32 mask)
+{
+    for(int shift = 0; shift < 32; shift += 8)
+        if(mask == quint32(0xff) << shift)
+            return shift;
+    return -1;
+}
+
+/**
+ * @brief BmpReader::BmpReader - Nothing is read until open()
+ *
+ */
+BmpReader::BmpReader(const QString &fileName, QIODevice::OpenMode mode)
+    : file(fileName), mode(mode)
+{
+    pixels = 0;
+    stride = 0;
+    topDown = false;
+    depth = 0;
+    redShift = 16;
+    greenShift = 8;
+    blueShift = 0;
+    alphaShift = -1;
+}
+
+/**
+ * @brief BmpReader::open - Maps the file and checks that it's a BMP with
+ *                          a layout this reader decodes, and all its
+ *                          pixels are there. Allocates the canvas's tiles.
+ *
+ */
+bool BmpReader::open()
+{
+    if(!file.open(mode))
+        return fail(file.errorString());
+
+    qint64 fileSize = file.size();
+    if(fileSize < MASKS_OFFSET)
+        return fail(QObject::tr("The file is too short to be a BMP."));
+
+    uchar *map = file.map(0, fileSize);
+    if(!map)
+        return fail(file.errorString());
+
+    if(map[0] != 'B' || map[1] != 'M')
+        return fail(QObject::tr("The file is not a BMP."));
+
+    quint32 offset = qFromLittleEndian<quint32>(map + 10);
+    quint32 headerSize = qFromLittleEndian<quint32>(map + 14);
+    qint32 width = qFromLittleEndian<qint32>(map + 18);
+    qint32 height = qFromLittleEndian<qint32>(map + 22);
+    quint16 planes = qFromLittleEndian<quint16>(map + 26);
+    quint16 bitCount = qFromLittleEndian<quint16>(map + 28);
+    quint32 compression = qFromLittleEndian<quint32>(map + 30);
+
+    if(headerSize < INFO_HEADER_SIZE || planes != 1 || width <= 0 ||
+       height == 0)
+        return fail(QObject::tr("The BMP header is not supported."));
+
+    // 24-bit BGR, or 32-bit with the channels where the masks say, each
+    // a whole byte
+    depth = bitCount;
+    if(depth == 32 && (compression == BI_BITFIELDS ||
+                       compression == BI_ALPHABITFIELDS))
+    {
+        bool hasAlpha = compression == BI_ALPHABITFIELDS || headerSize >= 56;
+        if(fileSize < MASKS_OFFSET + (hasAlpha ? 16 : 12))
+            return fail(QObject::tr("The file is too short to be a BMP."));
+
+        redShift = channelShift(qFromLittleEndian<quint32>(map + MASKS_OFFSET));
+        greenShift = channelShift(qFromLittleEndian<quint32>(map + MASKS_OFFSET + 4));
+        blueShift = channelShift(qFromLittleEndian<quint32>(map + MASKS_OFFSET + 8));
+        quint32 alphaMask = hasAlpha ?
+                    qFromLittleEndian<quint32>(map + MASKS_OFFSET + 12) : 0;
+        alphaShift = alphaMask ? channelShift(alphaMask) : -1;
+
+        if(redShift < 0 || greenShift < 0 || blueShift < 0 ||
+           (alphaMask && alphaShift < 0))
+            return fail(QObject::tr("The BMP channel layout is not supported."));
+    }
+    else if((depth != 24 && depth != 32) || compression != BI_RGB)
+        return fail(QObject::tr("Only uncompressed 24 and 32-bit BMPs are "
+                                "read directly."));
+
+    // rows are padded to 4 bytes; a negative height means top-down
+    qint64 rowBytes = ((qint64(width) * depth + 31) / 32) * 4;
+    qint64 rows = height < 0 ? -qint64(height) : qint64(height);
+    if(rowBytes > INT_MAX || offset + rowBytes * rows > fileSize)
+        return fail(QObject::tr("The BMP file is truncated."));
+
+    pixels = map + offset;
+    stride = int(rowBytes);
+    topDown = height < 0;
+
+    canvas = Canvas(QSize(width, int(rows)), Qt::transparent);
+    for(int i = 0; i < canvas.tileCount(); ++i)
+    {
+        QImage &tile = canvas.tile(i);
+        tile = QImage(canvas.tileRect(i).size(),
+                      QImage::Format_ARGB32_Premultiplied);
+        if(tile.isNull())
+            return fail(QObject::tr("Not enough memory for the image."));
+        tileBits.append(tile.bits());
+    }
+    return true;
+}
+
+/**
+ * @brief BmpReader::fail - Give up on the file, keeping the reason
+ *
+ */
+bool BmpReader::fail(const QString &message)
+{
+    error = message;
+    canvas = Canvas();
+    tileBits.clear();
+    pixels = 0;
+    file.close();
+    return false;
+}
+
+/**
+ * @brief BmpReader::bands - One per row of tiles
+ *
+ */
+int BmpReader::bands() const
+{
+    return (canvas.height() + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+/**
+ * @brief BmpReader::readBand - Decodes the rows of a band of tiles, each
+ *                              row straight from the map into the tiles
+ *                              it crosses
+ *
+ */
+void BmpReader::readBand(int band)
+{
+    int top = band * TILE_SIZE;
+    int bottom = qMin(top + TILE_SIZE, canvas.height());
+    int bytesPerPixel = depth / 8;
+
+    for(int y = top; y < bottom; ++y)
+    {
+        const uchar *row = rowAt(y);
+        for(int x = 0; x < canvas.width(); x += TILE_SIZE)
+        {
+            // 32-bit tile rows are exactly their width apart
+            int index = canvas.tileAt(x, y);
+            int width = canvas.tileRect(index).width();
+            quint32 *to = reinterpret_cast<quint32*>(tileBits.at(index)) +
+                          (y - top) * width;
+            readRow(row + x * bytesPerPixel, to, width);
+        }
+    }
+}
+
+/**
+ * @brief BmpReader::rowAt - Where row y of the image is in the map
+ *
+ */
+uchar* BmpReader::rowAt(int y) const
+{
+    return pixels + qint64(topDown ? y : canvas.height() - 1 - y) * stride;
+}
+
+/**
+ * @brief BmpReader::readRow - Converts count pixels to premultiplied ARGB
+ *
+ */
+void BmpReader::readRow(const uchar *from, quint32 *to, int count) const
+{
+    if(depth == 24)
+    {
+        for(int x = 0; x < count; ++x, from += 3)
+            to[x] = 0xff000000 | (from[2] << 16) | (from[1] << 8) | from[0];
+        return;
+    }
+
+    // the usual BGRA order is already a QRgb
+    bool bgra = redShift == 16 && greenShift == 8 && blueShift == 0;
+    if(alphaShift < 0)
+    {
+        for(int x = 0; x < count; ++x, from += 4)
+        {
+            quint32 p = qFromLittleEndian<quint32>(from);
+            to[x] = bgra ? p | 0xff000000
+                         : qRgb((p >> redShift) & 0xff, (p >> greenShift) & 0xff,
+                                (p >> blueShift) & 0xff);
+        }
+    }
+    else
+    {
+        for(int x = 0; x < count; ++x, from += 4)
+        {
+            quint32 p = qFromLittleEndian<quint32>(from);
+            if(!bgra || alphaShift != 24)
+                p = qRgba((p >> redShift) & 0xff, (p >> greenShift) & 0xff,
+                          (p >> blueShift) & 0xff, (p >> alphaShift) & 0xff);
+            to[x] = qPremultiply(p);
+        }
+    }
+}
+
+/**
+ * @brief BmpReader::readAll - Decodes every band on the thread pool
+ *
+ */
+void BmpReader::readAll()
+{
+    QVector<int> tileRows;
+    for(int i = 0; i < bands(); ++i)
+        tileRows.append(i);
+    QtConcurrent::blockingMap(tileRows, [this](int &band) {
+        readBand(band);
+    });
+}
+
+/**
+ * @brief BmpReader::writeChanges - Writes each tile of image that isn't
+ *                                  shared with the copy of the file back
+ *                                  into the map, then shares it, so the
+ *                                  next call only writes what changed
+ *                                  after this one
+ *
+ */
+int BmpReader::writeChanges(const Canvas &image)
+{
+    if(!(mode & QIODevice::WriteOnly) || !pixels || image.size() != size())
+        return -1;
+
+    int bytesPerPixel = depth / 8;
+    int written = 0;
+    for(int i = 0; i < canvas.tileCount(); ++i)
+    {
+        if(image.sharesTile(canvas, i))
+            continue;
+
+        const QImage &tile = image.tile(i);
+        QRect area = canvas.tileRect(i);
+        for(int y = area.top(); y <= area.bottom(); ++y)
+            writeRow(reinterpret_cast<const QRgb*>(
+                         tile.constScanLine(y - area.top())),
+                     rowAt(y) + area.left() * bytesPerPixel, area.width());
+
+        canvas.tile(i) = tile;
+        ++written;
+    }
+    return written;
+}
+
+/**
+ * @brief BmpReader::writeRow - Converts count premultiplied pixels to the
+ *                              file's layout
+ *
+ */
+void BmpReader::writeRow(const QRgb *from, uchar *to, int count) const
+{
+    for(int x = 0; x < count; ++x)
+    {
+        QRgb p = from[x];
+        if(qAlpha(p) != 255)
+            p = qUnpremultiply(p);
+
+        if(depth == 24)
+        {
+            to[0] = qBlue(p);
+            to[1] = qGreen(p);
+            to[2] = qRed(p);
+            to += 3;
+        }
+        else
+        {
+            quint32 v = quint32(qRed(p)) << redShift |
+                        quint32(qGreen(p)) << greenShift |
+                        quint32(qBlue(p)) << blueShift;
+            if(alphaShift >= 0)
+                v |= quint32(qAlpha(p)) << alphaShift;
+            qToLittleEndian<quint32>(v, to);
+            to += 4;
+        }
+    }
+}
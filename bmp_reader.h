@@ -0,0 +1,83 @@
+#ifndef BMP_READER_H
+#define BMP_READER_H
+
+#include <QFile>
+#include <QVector>
+
+#include "canvas.h"
+
+
+/**
+ * Decodes a 24 or 32-bit uncompressed BMP straight from a memory map of
+ * the file into the tiles of a canvas, with no whole-image copy in
+ * between. Rows may be stored bottom-up or top-down. The image is read in
+ * bands of one row of tiles each, which may be decoded on any thread and
+ * in any order. Anything else (palettes, RLE, 16-bit) is left to QImage.
+ *
+ * Opened for writing, the file stays mapped and its tiles are kept as
+ * they are on disk, so an edited copy of the image can be written back
+ * in place a changed tile at a time.
+ */
+class BmpReader
+{
+public:
+    explicit BmpReader(const QString &fileName,
+                       QIODevice::OpenMode mode = QIODevice::ReadOnly);
+
+    /** map the file, check its headers & allocate the tiles; false if it
+     *  isn't a BMP this reader decodes, see errorString() */
+    bool open();
+    QString errorString() const { return error; }
+    QSize size() const { return canvas.size(); }
+    QString fileName() const { return file.fileName(); }
+
+    /** the rows of tiles */
+    int bands() const;
+    void readBand(int band);
+
+    /** every band, spread over the global thread pool */
+    void readAll();
+
+    /** the decoded image, once every band is read */
+    Canvas result() const { return canvas; }
+
+    /** write the tiles of image that differ from the file's into the map;
+     *  returns how many, or -1 if the file isn't writable or the sizes
+     *  don't match */
+    int writeChanges(const Canvas &image);
+
+private:
+    bool fail(const QString &message);
+    uchar* rowAt(int y) const;
+    void readRow(const uchar *from, quint32 *to, int count) const;
+    void writeRow(const QRgb *from, uchar *to, int count) const;
+
+    QFile file;
+    QIODevice::OpenMode mode;
+    QString error;
+
+    /** the pixel rows in the map, in the order stored */
+    uchar* pixels;
+    int stride;
+    bool topDown;
+
+    /** 24 or 32; for 32, where each 8-bit channel sits in a pixel, with
+     *  alphaShift -1 if there is no alpha */
+    int depth;
+    int redShift;
+    int greenShift;
+    int blueShift;
+    int alphaShift;
+
+    /** the image being decoded into, then as it is on disk, and its
+     *  tiles' pixels, taken once so threads don't call the detaching
+     *  QImage accessors */
+    Canvas canvas;
+    QVector<uchar*> tileBits;
+
+    /** Don't allow copying */
+    BmpReader(const BmpReader&);
+    BmpReader& operator=(const BmpReader&);
+};
+
+#endif // BMP_READER_H
@@ -0,0 +1,104 @@
+#include <cstring>
+
+#include <QIODevice>
+#include <QObject>
+#include <QtEndian>
+#include <QVector>
+
+#include "bmp_writer.h"
+#include "canvas.h"
+
+
+/** BITMAPFILEHEADER & BITMAPINFOHEADER */
+static const int HEADER_SIZE = 14 + 40;
+
+/** rows are gathered into a buffer of about this size between writes */
+static const int CHUNK_BYTES = 1024 * 1024;
+
+/** 72 dpi, as QImage saves by default */
+static const int PIXELS_PER_METER = 2835;
+
+/**
+ * @brief writeHeader - The headers of an uncompressed bottom-up 24-bit
+ *                      BMP of size, with rows of rowBytes
+ *
+ */
+static void writeHeader(uchar *to, const QSize &size, int rowBytes,
+                        quint32 fileSize)
+{
+    memset(to, 0, HEADER_SIZE);
+    to[0] = 'B';
+    to[1] = 'M';
+    qToLittleEndian<quint32>(fileSize, to + 2);
+    qToLittleEndian<quint32>(HEADER_SIZE, to + 10);
+
+    qToLittleEndian<quint32>(40, to + 14);
+    qToLittleEndian<qint32>(size.width(), to + 18);
+    qToLittleEndian<qint32>(size.height(), to + 22);
+    qToLittleEndian<quint16>(1, to + 26);
+    qToLittleEndian<quint16>(24, to + 28);
+    qToLittleEndian<quint32>(quint32(rowBytes) * size.height(), to + 34);
+    qToLittleEndian<qint32>(PIXELS_PER_METER, to + 38);
+    qToLittleEndian<qint32>(PIXELS_PER_METER, to + 42);
+}
+
+/**
+ * @brief writeRow - Converts one row of the canvas to BGR, from each of
+ *                   the tiles it crosses; the padding is left as it is
+ *
+ */
+static void writeRow(const Canvas &canvas, int y, uchar *to)
+{
+    for(int x = 0; x < canvas.width(); x += TILE_SIZE)
+    {
+        int index = canvas.tileAt(x, y);
+        const QImage &tile = canvas.tile(index);
+        const QRgb *from = reinterpret_cast<const QRgb*>(
+                    tile.constScanLine(y - canvas.tileRect(index).top()));
+
+        for(int i = 0; i < tile.width(); ++i, to += 3)
+        {
+            // the BMP has no alpha; see-through pixels keep their color
+            QRgb p = from[i];
+            if(qAlpha(p) != 255)
+                p = qUnpremultiply(p);
+            to[0] = qBlue(p);
+            to[1] = qGreen(p);
+            to[2] = qRed(p);
+        }
+    }
+}
+
+QString writeBmp(const Canvas &canvas, QIODevice *device)
+{
+    int rowBytes = ((canvas.width() * 3 + 3) / 4) * 4;
+    qint64 fileSize = HEADER_SIZE + qint64(rowBytes) * canvas.height();
+    if(canvas.isNull() || fileSize > 0xffffffffLL)
+        return QObject::tr("The image is too big to save as a BMP.");
+
+    // as many rows as fit in a chunk, and at least one
+    int chunkRows = qMax(1, CHUNK_BYTES / rowBytes);
+    QVector<uchar> buffer(qMax(HEADER_SIZE,
+                               qMin(chunkRows, canvas.height()) * rowBytes), 0);
+
+    writeHeader(buffer.data(), canvas.size(), rowBytes, quint32(fileSize));
+    if(device->write(reinterpret_cast<const char*>(buffer.constData()),
+                     HEADER_SIZE) != HEADER_SIZE)
+        return device->errorString();
+
+    // bottom-up: the last row goes first
+    buffer.fill(0);
+    int y = canvas.height() - 1;
+    while(y >= 0)
+    {
+        int rows = qMin(chunkRows, y + 1);
+        for(int i = 0; i < rows; ++i, --y)
+            writeRow(canvas, y, buffer.data() + i * rowBytes);
+
+        qint64 bytes = qint64(rows) * rowBytes;
+        if(device->write(reinterpret_cast<const char*>(buffer.constData()),
+                         bytes) != bytes)
+            return device->errorString();
+    }
+    return QString();
+}
@@ -0,0 +1,19 @@
+#ifndef BMP_WRITER_H
+#define BMP_WRITER_H
+
+#include <QString>
+
+
+class Canvas;
+class QIODevice;
+
+/**
+ * Writes the canvas to device as a bottom-up 24-bit BMP, the same layout
+ * QImage saves. The headers go first, then the rows, last row first,
+ * converted straight from the tiles into a buffer of a fixed size that
+ * is written out whenever it fills. Returns an error message, or an
+ * empty string if it worked.
+ */
+QString writeBmp(const Canvas &canvas, QIODevice *device);
+
+#endif // BMP_WRITER_H
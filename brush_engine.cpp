@@ -0,0 +1,229 @@
+#include <cmath>
+#include <cstring>
+
+#include <QtGlobal>
+
+#include "brush_engine.h"
+#include "constants.h"
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define BLEND_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define BLEND_SSE2
+#endif
+
+
+/**
+ * @brief overlap - Length of the overlap of two intervals
+ *
+ */
+static qreal overlap(qreal a1, qreal a2, qreal b1, qreal b2)
+{
+    return qMax(qreal(0), qMin(a2, b2) - qMax(a1, b1));
+}
+
+/**
+ * @brief makeDab - Builds the mask for one width. Round dabs are
+ *                  supersampled 4x4 per pixel; square dabs get the exact
+ *                  area of each pixel they cover.
+ *
+ */
+static DabMask makeDab(DabShape shape, int width)
+{
+    DabMask dab;
+    dab.size = width + (width % 2 ? 2 : 3);
+    dab.coverage.resize(dab.size * dab.size);
+
+    // odd widths are centered on a pixel, even ones on a pixel corner, so
+    // that square dabs have crisp edges
+    const qreal center = width % 2 ? dab.size / 2.0 : dab.size / 2;
+    const qreal r = width / 2.0;
+    for(int y = 0; y < dab.size; ++y)
+    {
+        for(int x = 0; x < dab.size; ++x)
+        {
+            qreal covered = 0;
+            if(shape == square_dab)
+            {
+                covered = overlap(x, x + 1, center - r, center + r) *
+                          overlap(y, y + 1, center - r, center + r);
+            }
+            else
+            {
+                int inside = 0;
+                for(int sy = 0; sy < 4; ++sy)
+                    for(int sx = 0; sx < 4; ++sx)
+                    {
+                        qreal dx = x + (sx + 0.5) / 4 - center;
+                        qreal dy = y + (sy + 0.5) / 4 - center;
+                        if(dx * dx + dy * dy <= r * r)
+                            ++inside;
+                    }
+                covered = inside / 16.0;
+            }
+            dab.coverage[y * dab.size + x] = quint8(qRound(covered * 255));
+        }
+    }
+    return dab;
+}
+
+/**
+ * @brief dabMask - The cached mask for a shape and width. The table is
+ *                  a function-level static, so building it is thread-safe.
+ *
+ */
+const DabMask& dabMask(DabShape shape, int width)
+{
+    struct Table
+    {
+        QVector<DabMask> dabs[2];
+        Table()
+        {
+            for(int w = MIN_PEN_SIZE; w <= MAX_PEN_SIZE; ++w)
+            {
+                dabs[round_dab].append(makeDab(round_dab, w));
+                dabs[square_dab].append(makeDab(square_dab, w));
+            }
+        }
+    };
+    static const Table table;
+
+    width = qBound(MIN_PEN_SIZE, width, MAX_PEN_SIZE);
+    return table.dabs[shape].at(width - MIN_PEN_SIZE);
+}
+
+/**
+ * Source-over of a premultiplied color c at coverage m, per channel:
+ *
+ *     src = c * m / 255
+ *     dst = src + dst * (255 - alpha(src)) / 255
+ *
+ * x / 255 is rounded as (t + (t >> 8)) >> 8 with t = x + 128, in the
+ * scalar code and the vector code alike, so they give the same pixels.
+ */
+static inline quint32 div255(quint32 x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline quint32 blendPixel(quint32 dst, quint32 color, quint32 m)
+{
+    quint32 src[4], out = 0;
+    for(int c = 0; c < 4; ++c)
+        src[c] = div255(((color >> (8 * c)) & 0xff) * m);
+    for(int c = 0; c < 4; ++c)
+    {
+        quint32 d = (dst >> (8 * c)) & 0xff;
+        out |= (src[c] + div255(d * (255 - src[3]))) << (8 * c);
+    }
+    return out;
+}
+
+#ifdef BLEND_SSE2
+static inline __m128i div255(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/**
+ * @brief blend2 - Two pixels, unpacked to 16 bits a channel, with their
+ *                 coverage already spread over their channels
+ *
+ */
+static inline __m128i blend2(__m128i dst, __m128i color, __m128i m)
+{
+    __m128i src = div255(_mm_mullo_epi16(color, m));
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)),
+                                        _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    return _mm_add_epi16(src, div255(_mm_mullo_epi16(dst, inverse)));
+}
+#endif
+
+#ifdef BLEND_AVX2
+static inline __m256i div255(__m256i x)
+{
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+static inline __m256i blend2(__m256i dst, __m256i color, __m256i m)
+{
+    __m256i src = div255(_mm256_mullo_epi16(color, m));
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, _MM_SHUFFLE(3, 3, 3, 3)),
+                                           _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    return _mm256_add_epi16(src, div255(_mm256_mullo_epi16(dst, inverse)));
+}
+#endif
+
+/**
+ * @brief blendSpan - Blends a row of a dab into the canvas. Fully covered
+ *                    pixels of an opaque color are just written, and
+ *                    uncovered ones skipped; the rest go through AVX2 or
+ *                    SSE2 eight or four at a time where the build has them.
+ *
+ */
+void blendSpan(quint32 *dst, const quint8 *coverage, int count, quint32 color)
+{
+    int x = 0;
+#ifdef BLEND_AVX2
+    const __m256i zero256 = _mm256_setzero_si256();
+    const __m256i color256 = _mm256_unpacklo_epi8(_mm256_set1_epi32(int(color)), zero256);
+    for(; x + 8 <= count; x += 8)
+    {
+        quint64 m8;
+        memcpy(&m8, coverage + x, 8);
+        if(!m8)
+            continue;
+
+        // spread each coverage byte over its pixel's four channels
+        __m256i m = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(qint64(m8))),
+                                       _mm256_set1_epi32(0x01010101));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + x));
+        __m256i lo = blend2(_mm256_unpacklo_epi8(d, zero256), color256,
+                            _mm256_unpacklo_epi8(m, zero256));
+        __m256i hi = blend2(_mm256_unpackhi_epi8(d, zero256), color256,
+                            _mm256_unpackhi_epi8(m, zero256));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),
+                            _mm256_packus_epi16(lo, hi));
+    }
+#endif
+#ifdef BLEND_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i color128 = _mm_unpacklo_epi8(_mm_set1_epi32(int(color)), zero);
+    for(; x + 4 <= count; x += 4)
+    {
+        quint32 m4;
+        memcpy(&m4, coverage + x, 4);
+        if(!m4)
+            continue;
+
+        __m128i m = _mm_cvtsi32_si128(int(m4));
+        m = _mm_unpacklo_epi8(m, m);
+        m = _mm_unpacklo_epi16(m, m);
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x));
+        __m128i lo = blend2(_mm_unpacklo_epi8(d, zero), color128,
+                            _mm_unpacklo_epi8(m, zero));
+        __m128i hi = blend2(_mm_unpackhi_epi8(d, zero), color128,
+                            _mm_unpackhi_epi8(m, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                         _mm_packus_epi16(lo, hi));
+    }
+#endif
+    const bool opaque = (color >> 24) == 0xff;
+    for(; x < count; ++x)
+    {
+        if(coverage[x] == 0)
+            continue;
+        if(coverage[x] == 255 && opaque)
+            dst[x] = color;
+        else
+            dst[x] = blendPixel(dst[x], color, coverage[x]);
+    }
+}
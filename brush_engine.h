@@ -0,0 +1,31 @@
+#ifndef BRUSH_ENGINE_H
+#define BRUSH_ENGINE_H
+
+#include <QVector>
+
+
+/** dab shapes, for the pen's round & square caps */
+enum DabShape {round_dab, square_dab};
+
+/**
+ * Antialiased coverage (0-255) of one dab. The mask is an odd number of
+ * pixels across; the dab is centered on the middle pixel, or on its top
+ * left corner when the width is even.
+ */
+struct DabMask
+{
+    int size;
+    QVector<quint8> coverage;
+
+    int radius() const { return size / 2; }
+    const quint8* row(int y) const { return coverage.constData() + y * size; }
+};
+
+/** the cached mask for a width from MIN_PEN_SIZE to MAX_PEN_SIZE; all of
+ *  them are built the first time one is asked for */
+const DabMask& dabMask(DabShape shape, int width);
+
+/** blend a premultiplied color over count pixels, scaled by coverage */
+void blendSpan(quint32 *dst, const quint8 *coverage, int count, quint32 color);
+
+#endif // BRUSH_ENGINE_H
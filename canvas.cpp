@@ -0,0 +1,658 @@
+#include <cstring>
+
+#include <QMutex>
+#include <QtMath>
+
+#include "brush_engine.h"
+#include "canvas.h"
+#include "flood_fill.h"
+#include "render_thread.h"
+
+
+/**
+ * The placeholder tiles handed out, by size and color, and the colors of
+ * the placeholders by cache key. Canvases on either thread use them.
+ */
+static QMutex solidMutex;
+static QHash<quint64, QImage> solidTiles;
+static QHash<qint64, QRgb> solidColors;
+
+/**
+ * @brief Canvas::Canvas - Creates a canvas filled with a single color,
+ *                         see fill()
+ *
+ */
+Canvas::Canvas(const QSize &size, const QColor &color)
+{
+    imageSize = size;
+    tiles.resize(columns() * ((size.height() + TILE_SIZE - 1) / TILE_SIZE));
+    fill(color);
+}
+
+/**
+ * @brief Canvas::Canvas - Splits an image into tiles
+ *
+ */
+Canvas::Canvas(const QImage &image)
+{
+    QImage pixels = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    imageSize = image.size();
+    tiles.resize(columns() * ((image.height() + TILE_SIZE - 1) / TILE_SIZE));
+    for(int i = 0; i < tiles.size(); ++i)
+        tiles[i] = pixels.copy(tileRect(i));
+}
+
+/**
+ * @brief Canvas::swap - Trades contents with another canvas without
+ *                       copying anything
+ *
+ */
+void Canvas::swap(Canvas &other)
+{
+    qSwap(imageSize, other.imageSize);
+    tiles.swap(other.tiles);
+}
+
+/**
+ * @brief Canvas::tileRect - The area of the image covered by a tile. Tiles
+ *                           along the right and bottom edges may be smaller.
+ *
+ */
+QRect Canvas::tileRect(int index) const
+{
+    QRect r((index % columns()) * TILE_SIZE, (index / columns()) * TILE_SIZE,
+            TILE_SIZE, TILE_SIZE);
+    return r.intersected(rect());
+}
+
+/**
+ * @brief Canvas::tilesIn - The indexes of the tiles that overlap an area
+ *
+ */
+QVector<int> Canvas::tilesIn(const QRect &area) const
+{
+    QVector<int> indexes;
+    QRect r = area.normalized().intersected(rect());
+    if(r.isEmpty())
+        return indexes;
+
+    for(int row = r.top() / TILE_SIZE; row <= r.bottom() / TILE_SIZE; ++row)
+        for(int col = r.left() / TILE_SIZE; col <= r.right() / TILE_SIZE; ++col)
+            indexes.append(row * columns() + col);
+    return indexes;
+}
+
+/**
+ * @brief Canvas::sharesTile - Returns true if a tile is still shared with
+ *                             another canvas, i.e. it hasn't been drawn on
+ *                             since one was copied from the other
+ *
+ */
+bool Canvas::sharesTile(const Canvas &other, int index) const
+{
+    return other.size() == size() &&
+           other.tile(index).cacheKey() == tile(index).cacheKey();
+}
+
+/**
+ * @brief Canvas::solidColor - Returns true if the tile is a placeholder
+ *                             that hasn't been drawn on, and its color
+ *
+ */
+bool Canvas::solidColor(const QImage &tile, QRgb *color)
+{
+    QMutexLocker lock(&solidMutex);
+    QHash<qint64, QRgb>::const_iterator it = solidColors.constFind(tile.cacheKey());
+    if(it == solidColors.constEnd())
+        return false;
+    if(color)
+        *color = it.value();
+    return true;
+}
+
+/**
+ * @brief Canvas::solidTile - The placeholder for a tile size and color,
+ *                            made the first time it is asked for. The ones
+ *                            no tile uses anymore are let go of then.
+ *
+ */
+QImage Canvas::solidTile(const QSize &size, QRgb color)
+{
+    quint64 key = (quint64(size.width()) << 48) | (quint64(size.height()) << 32) |
+                  color;
+
+    QMutexLocker lock(&solidMutex);
+    QHash<quint64, QImage>::iterator it = solidTiles.find(key);
+    if(it != solidTiles.end())
+        return it.value();
+
+    for(it = solidTiles.begin(); it != solidTiles.end(); )
+    {
+        if(it.value().isDetached())
+        {
+            solidColors.remove(it.value().cacheKey());
+            it = solidTiles.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    QImage tile(size, QImage::Format_ARGB32_Premultiplied);
+    tile.fill(color);
+    solidTiles.insert(key, tile);
+    solidColors.insert(tile.cacheKey(), color);
+    return tile;
+}
+
+/**
+ * @brief Canvas::fill - Fills the whole canvas with a color. Every tile of
+ *                       a size shares one placeholder, so only a handful of
+ *                       tiles are actually filled.
+ *
+ */
+void Canvas::fill(const QColor &color)
+{
+    QRgb pixel = qPremultiply(color.rgba());
+    for(int i = 0; i < tiles.size(); ++i)
+        tiles[i] = solidTile(tileRect(i).size(), pixel);
+}
+
+/**
+ * @brief Canvas::copy - Puts the tiles covering an area back together
+ *                       into a single image
+ *
+ */
+QImage Canvas::copy(const QRect &area) const
+{
+    if(area.isEmpty())
+        return QImage();
+
+    QImage image(area.size(), QImage::Format_ARGB32_Premultiplied);
+    if(!rect().contains(area))
+        image.fill(Qt::transparent);
+
+    // tiles and image share a format, so rows can be copied as they are
+    QVector<int> indexes = tilesIn(area);
+    for(int i = 0; i < indexes.size(); ++i)
+    {
+        const QImage &tile = tiles.at(indexes[i]);
+        QRect tileRect = this->tileRect(indexes[i]);
+        QRect r = tileRect.intersected(area);
+        for(int y = r.top(); y <= r.bottom(); ++y)
+            memcpy(image.scanLine(y - area.top()) + (r.left() - area.left()) * 4,
+                   tile.constScanLine(y - tileRect.top()) + (r.left() - tileRect.left()) * 4,
+                   r.width() * 4);
+    }
+    return image;
+}
+
+/**
+ * @brief Canvas::columns - Number of tiles across
+ *
+ */
+int Canvas::columns() const
+{
+    return (imageSize.width() + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+/**
+ * @brief CanvasPainter::CanvasPainter - Tile painters are opened as the
+ *                                       drawing reaches them
+ *
+ */
+CanvasPainter::CanvasPainter(Canvas *canvas, RenderThread *thread)
+{
+    this->canvas = canvas;
+    this->thread = thread;
+    stampDistance = 0;
+    compositionMode = QPainter::CompositionMode_SourceOver;
+    thinPen = false;
+    thinColor = 0;
+    writeTile = -1;
+    writeBits = 0;
+    writeBpl = 0;
+}
+
+CanvasPainter::~CanvasPainter()
+{
+    qDeleteAll(painters);
+}
+
+/**
+ * @brief CanvasPainter::setPen - Set the pen on every tile painter
+ *
+ */
+void CanvasPainter::setPen(const QPen &pen)
+{
+    this->pen = pen;
+    updateThinPen();
+    if(thread)
+    {
+        PaintOp op(PaintOp::set_pen);
+        op.pen = pen;
+        thread->post(op);
+    }
+    for(QPainter *painter : painters)
+        painter->setPen(pen);
+}
+
+/**
+ * @brief CanvasPainter::setBrush - Set the brush on every tile painter
+ *
+ */
+void CanvasPainter::setBrush(const QBrush &brush)
+{
+    this->brush = brush;
+    if(thread)
+    {
+        PaintOp op(PaintOp::set_brush);
+        op.brush = brush;
+        thread->post(op);
+    }
+    for(QPainter *painter : painters)
+        painter->setBrush(brush);
+}
+
+/**
+ * @brief CanvasPainter::setCompositionMode - Set the composition mode on
+ *                                            every tile painter
+ *
+ */
+void CanvasPainter::setCompositionMode(QPainter::CompositionMode mode)
+{
+    compositionMode = mode;
+    updateThinPen();
+    if(thread)
+    {
+        PaintOp op(PaintOp::set_composition_mode);
+        op.mode = mode;
+        thread->post(op);
+    }
+    for(QPainter *painter : painters)
+        painter->setCompositionMode(mode);
+}
+
+void CanvasPainter::drawLine(const QPoint &p1, const QPoint &p2)
+{
+    paint(strokeBounds(QRect(p1, p2), pen));
+    if(thread)
+    {
+        PaintOp op(PaintOp::draw_line);
+        op.points << p1 << p2;
+        thread->post(op);
+        return;
+    }
+    if(thinPen)
+    {
+        writeLine(p1, p2);
+        return;
+    }
+    for(int i = 0; i < tiles.size(); ++i)
+        painterFor(tiles[i])->drawLine(p1, p2);
+}
+
+void CanvasPainter::drawPolyline(const QPolygon &points)
+{
+    paint(strokeBounds(points.boundingRect(), pen));
+    if(thread)
+    {
+        PaintOp op(PaintOp::draw_polyline);
+        op.points = points;
+        thread->post(op);
+        return;
+    }
+    if(thinPen)
+    {
+        for(int i = 1; i < points.size(); ++i)
+            writeLine(points[i - 1], points[i]);
+        return;
+    }
+    for(int i = 0; i < tiles.size(); ++i)
+        painterFor(tiles[i])->drawPolyline(points);
+}
+
+void CanvasPainter::drawRect(const QRect &rect)
+{
+    paint(strokeBounds(rect, pen));
+    if(thread)
+    {
+        PaintOp op(PaintOp::draw_rect);
+        op.rect = rect;
+        thread->post(op);
+        return;
+    }
+    for(int i = 0; i < tiles.size(); ++i)
+        painterFor(tiles[i])->drawRect(rect);
+}
+
+void CanvasPainter::fillRect(const QRect &rect, const QColor &color)
+{
+    paint(rect);
+    if(thread)
+    {
+        PaintOp op(PaintOp::fill_rect);
+        op.rect = rect;
+        op.color = color;
+        thread->post(op);
+        return;
+    }
+    for(int i = 0; i < tiles.size(); ++i)
+        painterFor(tiles[i])->fillRect(rect, color);
+}
+
+void CanvasPainter::drawRoundedRect(const QRect &rect, qreal xRadius,
+                                    qreal yRadius, Qt::SizeMode mode)
+{
+    paint(strokeBounds(rect, pen));
+    if(thread)
+    {
+        PaintOp op(PaintOp::draw_rounded_rect);
+        op.rect = rect;
+        op.xRadius = xRadius;
+        op.yRadius = yRadius;
+        op.sizeMode = mode;
+        thread->post(op);
+        return;
+    }
+    for(int i = 0; i < tiles.size(); ++i)
+        painterFor(tiles[i])->drawRoundedRect(rect, xRadius, yRadius, mode);
+}
+
+void CanvasPainter::drawEllipse(const QRect &rect)
+{
+    paint(strokeBounds(rect, pen));
+    if(thread)
+    {
+        PaintOp op(PaintOp::draw_ellipse);
+        op.rect = rect;
+        thread->post(op);
+        return;
+    }
+    for(int i = 0; i < tiles.size(); ++i)
+        painterFor(tiles[i])->drawEllipse(rect);
+}
+
+void CanvasPainter::drawImage(const QPoint &point, const QImage &image)
+{
+    paint(QRect(point, image.size()));
+    if(thread)
+    {
+        PaintOp op(PaintOp::draw_image);
+        op.rect = QRect(point, image.size());
+        op.image = image;
+        thread->post(op);
+        return;
+    }
+    for(int i = 0; i < tiles.size(); ++i)
+        painterFor(tiles[i])->drawImage(point, image);
+}
+
+/**
+ * @brief CanvasPainter::stampPolyline - Draws the line as a row of the pen's
+ *                                       dabs, blended straight into the
+ *                                       tiles: round dabs for a round cap,
+ *                                       square ones for a square cap. The
+ *                                       distance past the last dab carries
+ *                                       into the next call, so a stroke
+ *                                       drawn in batches stays evenly
+ *                                       spaced. A single point is one dab.
+ *
+ */
+void CanvasPainter::stampPolyline(const QPolygon &points, qreal spacing)
+{
+    if(points.isEmpty())
+        return;
+
+    const DabMask &dab = dabMask(pen.capStyle() == Qt::SquareCap ? square_dab
+                                                                 : round_dab,
+                                 qRound(pen.widthF()));
+    int r = dab.radius();
+    paint(points.boundingRect().adjusted(-r, -r, r, r));
+    if(thread)
+    {
+        PaintOp op(PaintOp::stamp_polyline);
+        op.points = points;
+        op.spacing = spacing;
+        thread->post(op);
+        return;
+    }
+
+    const quint32 color = qPremultiply(pen.color().rgba());
+    const qreal step = qMax(qreal(1), spacing * pen.widthF());
+    for(int i = qMin(1, points.size() - 1); i < points.size(); ++i)
+    {
+        QPointF from = points[qMax(0, i - 1)], to = points[i];
+        QPointF delta = to - from;
+        qreal length = qSqrt(delta.x() * delta.x() + delta.y() * delta.y());
+
+        for(; stampDistance <= length; stampDistance += step)
+        {
+            qreal t = length > 0 ? stampDistance / length : 0;
+            stampDab((from + delta * t).toPoint(), dab, color);
+        }
+        stampDistance -= length;
+    }
+}
+
+/**
+ * @brief CanvasPainter::floodFill - Fills the area around seed. How far the
+ *                                   fill spreads is only known once it is
+ *                                   done, so while recording the whole
+ *                                   image counts as painted.
+ *
+ */
+void CanvasPainter::floodFill(const QPoint &seed, const QColor &color,
+                              int tolerance)
+{
+    if(thread)
+    {
+        paint(canvas->rect());
+        PaintOp op(PaintOp::flood_fill);
+        op.points << seed;
+        op.color = color;
+        op.tolerance = tolerance;
+        thread->post(op);
+        return;
+    }
+
+    QRect area = ::floodFill(canvas, seed, color, tolerance);
+    painted |= area;
+    lastPainted = area;
+}
+
+/**
+ * @brief CanvasPainter::stampDab - Blends one dab into each tile under it
+ *
+ */
+void CanvasPainter::stampDab(const QPoint &center, const DabMask &dab,
+                             quint32 color)
+{
+    QRect rect(center.x() - dab.radius(), center.y() - dab.radius(),
+               dab.size, dab.size);
+    QRect area = rect.intersected(canvas->rect());
+    QVector<int> under = canvas->tilesIn(area);
+
+    for(int i = 0; i < under.size(); ++i)
+    {
+        QRect tileRect = canvas->tileRect(under[i]);
+        QRect part = area.intersected(tileRect);
+
+        // bits() detaches the tile from any copies of the canvas
+        QImage &tile = canvas->tile(under[i]);
+        uchar *bits = tile.bits();
+        int bpl = tile.bytesPerLine();
+
+        for(int y = part.top(); y <= part.bottom(); ++y)
+        {
+            quint32 *dst = reinterpret_cast<quint32*>(
+                        bits + (y - tileRect.top()) * bpl) +
+                        (part.left() - tileRect.left());
+            blendSpan(dst, dab.row(y - rect.top()) + (part.left() - rect.left()),
+                      part.width(), color);
+        }
+    }
+}
+
+/**
+ * @brief CanvasPainter::updateThinPen - Lines drawn with a solid, opaque
+ *                                       pen no more than a pixel wide are
+ *                                       just rows of pixels set to the
+ *                                       pen color, so they skip QPainter
+ *
+ */
+void CanvasPainter::updateThinPen()
+{
+    thinPen = pen.style() == Qt::SolidLine && pen.widthF() <= 1 &&
+              pen.brush().style() == Qt::SolidPattern &&
+              pen.color().alpha() == 255 &&
+              compositionMode == QPainter::CompositionMode_SourceOver;
+    thinColor = pen.color().rgba();
+}
+
+/**
+ * @brief CanvasPainter::writeLine - Draws a 1px line the way QPainter's
+ *                                   cosmetic stroker does with antialiasing
+ *                                   off, so the pixels come out the same:
+ *                                   the end points go to 26.6 fixed point,
+ *                                   the line is walked one pixel at a time
+ *                                   along its longer axis, and the other
+ *                                   coordinate is stepped in 16.16. Caps
+ *                                   other than flat reach half a pixel past
+ *                                   either end, so the last pixel is drawn.
+ *
+ */
+void CanvasPainter::writeLine(const QPoint &p1, const QPoint &p2)
+{
+    writeTile = -1;
+    if(p1 == p2)
+    {
+        writePixel(p1.x(), p1.y());
+        return;
+    }
+
+    int x1 = p1.x() * 64, y1 = p1.y() * 64;
+    int x2 = p2.x() * 64, y2 = p2.y() * 64;
+
+    // walk along x; a steep line is walked with the axes swapped
+    bool steep = qAbs(x2 - x1) < qAbs(y2 - y1);
+    if(steep)
+    {
+        qSwap(x1, y1);
+        qSwap(x2, y2);
+    }
+    if(x1 > x2)
+    {
+        qSwap(x1, x2);
+        qSwap(y1, y2);
+    }
+
+    int inc = int((qint64(y2 - y1) << 16) / (x2 - x1));
+    int y = y1 * 1024;
+    if(pen.capStyle() != Qt::FlatCap)
+    {
+        x1 -= 32;
+        y -= inc >> 1;
+        x2 += 32;
+    }
+
+    int x = (x1 + 32) >> 6;
+    int end = (x2 + 32) >> 6;
+    if(x == end)
+        return;
+
+    y += ((x * 64) + (inc > 0 ? 32 : 0) - x1) * inc >> 6;
+    for(; x < end; ++x, y += inc)
+    {
+        if(steep)
+            writePixel(y >> 16, x);
+        else
+            writePixel(x, y >> 16);
+    }
+}
+
+/**
+ * @brief CanvasPainter::writePixel - Sets one pixel to the pen color. The
+ *                                    tile is looked up, and detached from
+ *                                    any copies of the canvas, only when
+ *                                    the line crosses into it.
+ *
+ */
+void CanvasPainter::writePixel(int x, int y)
+{
+    if(!canvas->rect().contains(x, y))
+        return;
+
+    int index = canvas->tileAt(x, y);
+    if(index != writeTile)
+    {
+        QImage &tile = canvas->tile(index);
+        writeTile = index;
+        writeBits = tile.bits();
+        writeBpl = tile.bytesPerLine();
+        writeOrigin = canvas->tileRect(index).topLeft();
+    }
+    reinterpret_cast<quint32*>(writeBits + (y - writeOrigin.y()) * writeBpl)
+            [x - writeOrigin.x()] = thinColor;
+}
+
+/**
+ * @brief CanvasPainter::paint - Find the tiles under the area about to be
+ *                               drawn on, and add it to the painted area
+ *
+ */
+void CanvasPainter::paint(const QRect &bounds)
+{
+    QRect area = bounds.normalized().intersected(canvas->rect());
+    painted |= area;
+    lastPainted = area;
+    if(!thread)
+        tiles = canvas->tilesIn(area);
+}
+
+/**
+ * @brief CanvasPainter::painterFor - Get the painter for a tile, opening
+ *                                    one if this is the first time it is
+ *                                    drawn on. Opening a painter detaches
+ *                                    the tile from any copies of the canvas.
+ *
+ */
+QPainter* CanvasPainter::painterFor(int index)
+{
+    QPainter *painter = painters.value(index);
+    if(painter)
+        return painter;
+
+    painter = new QPainter(&canvas->tile(index));
+    painter->translate(-canvas->tileRect(index).topLeft());
+    painter->setPen(pen);
+    painter->setBrush(brush);
+    painter->setCompositionMode(compositionMode);
+    painters.insert(index, painter);
+    return painter;
+}
+
+/**
+ * @brief CanvasPainter::strokeBounds - The area a shape may cover once
+ *                                      it is stroked with the pen. Round
+ *                                      and flat caps reach half the width
+ *                                      out; square caps and the miter
+ *                                      joins of a right angle reach the
+ *                                      corner of that square, half the
+ *                                      width times sqrt(2). The extra
+ *                                      pixel covers rounding to the grid.
+ *
+ */
+QRect CanvasPainter::strokeBounds(const QRect &rect, const QPen &pen)
+{
+    if(pen.style() == Qt::NoPen)
+        return rect.normalized().adjusted(-1, -1, 1, 1);
+
+    // a cosmetic pen is one pixel wide
+    qreal reach = qMax(pen.widthF(), qreal(1)) / 2;
+    if(pen.capStyle() == Qt::SquareCap || pen.joinStyle() == Qt::MiterJoin)
+        reach *= M_SQRT2;
+
+    int pad = qCeil(reach) + 1;
+    return rect.normalized().adjusted(-pad, -pad, pad, pad);
+}
@@ -0,0 +1,142 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <QHash>
+#include <QImage>
+#include <QPainter>
+#include <QVector>
+
+#include "constants.h"
+
+
+/**
+ * The image being edited, split into TILE_SIZE square tiles. Tiles are
+ * ARGB32_Premultiplied images, so their scanlines can be read and written
+ * directly. They are implicitly shared, so copying a Canvas is cheap and
+ * a tile is only duplicated once something draws on it.
+ *
+ * A canvas of one color, new or cleared, starts out with every tile
+ * sharing a single placeholder image of that color. Drawing on a tile
+ * detaches it from the placeholder like from any other copy.
+ */
+class Canvas
+{
+public:
+    Canvas() {}
+    Canvas(const QSize &size, const QColor &color);
+    explicit Canvas(const QImage &image);
+
+    bool isNull() const { return tiles.isEmpty(); }
+    QSize size() const { return imageSize; }
+    int width() const { return imageSize.width(); }
+    int height() const { return imageSize.height(); }
+    QRect rect() const { return QRect(QPoint(0, 0), imageSize); }
+    void swap(Canvas &other);
+
+    /** tile access */
+    int tileCount() const { return tiles.size(); }
+    QRect tileRect(int index) const;
+    QVector<int> tilesIn(const QRect &area) const;
+    int tileAt(int x, int y) const
+        { return (y / TILE_SIZE) * columns() + x / TILE_SIZE; }
+    const QImage& tile(int index) const { return tiles.at(index); }
+    QImage& tile(int index) { return tiles[index]; }
+    bool sharesTile(const Canvas &other, int index) const;
+
+    /** whether a tile is still a placeholder of one color, and which; and
+     *  the placeholder shared by every tile of a size and color */
+    static bool solidColor(const QImage &tile, QRgb *color = 0);
+    static QImage solidTile(const QSize &size, QRgb color);
+
+    /** whole image operations */
+    void fill(const QColor &color);
+    QImage copy(const QRect &area) const;
+    QImage toImage() const { return copy(rect()); }
+
+private:
+    int columns() const;
+
+    QSize imageSize;
+    QVector<QImage> tiles;
+};
+
+class RenderThread;
+struct DabMask;
+
+/**
+ * Draws on a Canvas as if it were a single image, opening a QPainter on
+ * each tile the drawing touches. Given a RenderThread, it only records
+ * the calls and queues them for that thread to draw; the canvas is then
+ * just used to clip the painted area.
+ */
+class CanvasPainter
+{
+public:
+    explicit CanvasPainter(Canvas *canvas, RenderThread *thread = 0);
+    ~CanvasPainter();
+
+    void setPen(const QPen &pen);
+    void setBrush(const QBrush &brush);
+    void setCompositionMode(QPainter::CompositionMode mode);
+
+    void drawLine(const QPoint &p1, const QPoint &p2);
+    void drawPolyline(const QPolygon &points);
+    void drawRect(const QRect &rect);
+    void fillRect(const QRect &rect, const QColor &color);
+    void drawRoundedRect(const QRect &rect, qreal xRadius, qreal yRadius,
+                         Qt::SizeMode mode = Qt::AbsoluteSize);
+    void drawEllipse(const QRect &rect);
+    void drawImage(const QPoint &point, const QImage &image);
+
+    /** stamp the pen's dab along the line, spacing * width apart */
+    void stampPolyline(const QPolygon &points, qreal spacing);
+
+    /** bucket fill around a point, see floodFill() */
+    void floodFill(const QPoint &seed, const QColor &color, int tolerance);
+
+    /** everything drawn so far fits in this area, and the last call's
+     *  drawing in the second */
+    QRect paintedArea() const { return painted; }
+    QRect lastPaintedArea() const { return lastPainted; }
+
+    /** the area a shape with these bounds covers once stroked with the pen */
+    static QRect strokeBounds(const QRect &rect, const QPen &pen);
+
+private:
+    void paint(const QRect &bounds);
+    QPainter* painterFor(int index);
+    void stampDab(const QPoint &center, const DabMask &dab, quint32 color);
+    void writeLine(const QPoint &p1, const QPoint &p2);
+    void writePixel(int x, int y);
+    void updateThinPen();
+
+    Canvas* canvas;
+    RenderThread* thread;
+    QHash<int, QPainter*> painters;
+    QVector<int> tiles;
+    QRect painted;
+    QRect lastPainted;
+
+    /** how far along the line the next dab goes */
+    qreal stampDistance;
+
+    /** state applied to every tile painter */
+    QPen pen;
+    QBrush brush;
+    QPainter::CompositionMode compositionMode;
+
+    /** a solid, opaque 1px pen: lines are written straight into the tiles,
+     *  into the tile last written to while a line is drawn */
+    bool thinPen;
+    quint32 thinColor;
+    int writeTile;
+    uchar* writeBits;
+    int writeBpl;
+    QPoint writeOrigin;
+
+    /** Don't allow copying */
+    CanvasPainter(const CanvasPainter&);
+    CanvasPainter& operator=(const CanvasPainter&);
+};
+
+#endif // CANVAS_H
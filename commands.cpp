@@ -1,18 +1,75 @@
+#include <QDataStream>
+
 #include "commands.h"
+#include "project_file.h"
+#include "undo_journal.h"
 #include "qrect.h"
 
 
 /**
- * @brief DrawCommand::DrawCommand - A command that keeps a copy of the image
- *                                   before and after something is drawn
+ * @brief DrawCommand::DrawCommand - A command that keeps the tiles that
+ *                                   changed when something was drawn. If
+ *                                   the image was resized, the whole old
+ *                                   image is kept.
+ *
+ *                                   The tiles are shared with the old
+ *                                   image, so nothing is copied. Undo and
+ *                                   redo swap them with the ones on the
+ *                                   canvas, so the command always holds
+ *                                   the version that isn't showing.
+ *                                   Placeholder tiles of one color, e.g.
+ *                                   from a new or cleared image, take no
+ *                                   room and are never packed.
  */
-DrawCommand::DrawCommand(const QPixmap &oldImage, QPixmap *image,
-                               QUndoCommand *parent)
+DrawCommand::DrawCommand(const Canvas &oldImage, Canvas *image,
+                         const QRect &area, QUndoCommand *parent)
     : QUndoCommand(parent)
 {
     this->image = image;
-    this->oldImage = oldImage;
-    newImage = image->copy(QRect());
+    resized = oldImage.size() != image->size();
+    applied = true;
+    storage = in_memory;
+    journal = 0;
+    record = -1;
+    project = 0;
+    savedTo = 0;
+
+    if(resized)
+        other = oldImage;
+    else
+    {
+        QVector<int> touched = image->tilesIn(area);
+        for(int i = 0; i < touched.size(); ++i)
+        {
+            if(image->sharesTile(oldImage, touched[i]))
+                continue;
+            indexes.append(touched[i]);
+            tiles.append(oldImage.tile(touched[i]));
+        }
+    }
+    bytes = countBytes();
+}
+
+/**
+ * @brief DrawCommand::DrawCommand - Reads back a command written by
+ *                                   save(). Only which tiles it swaps is
+ *                                   read; the tiles stay in the project
+ *                                   until they're needed.
+ */
+DrawCommand::DrawCommand(Canvas *image, QDataStream &in, ProjectFile *project,
+                         QUndoCommand *parent)
+    : QUndoCommand(parent)
+{
+    this->image = image;
+    applied = true;
+    storage = in_project;
+    journal = 0;
+    record = -1;
+    this->project = project;
+    savedTo = 0;
+    bytes = 0;
+
+    in >> resized >> indexes >> data;
 }
 
 /**
@@ -20,13 +77,363 @@ DrawCommand::DrawCommand(const QPixmap &oldImage, QPixmap *image,
  */
 void DrawCommand::undo()
 {
-    *image = oldImage.copy(QRect());
+    if(!applied)
+        return;
+    swap();
+    applied = false;
 }
 
 /**
- * @brief DrawCommand::redo - 'Undo' an undo, restoring the new image
+ * @brief DrawCommand::redo - 'Undo' an undo, restoring the new image. The
+ *                            first redo comes from being pushed on the
+ *                            stack, when the image is already drawn.
  */
 void DrawCommand::redo()
 {
-    *image = newImage.copy(QRect());
+    if(applied)
+        return;
+    swap();
+    applied = true;
+}
+
+/**
+ * @brief DrawCommand::getArea - The tiles the command swaps, or the whole
+ *                               image if it was resized
+ */
+QRect DrawCommand::getArea() const
+{
+    if(resized)
+        return image->rect();
+
+    QRect area;
+    for(int i = 0; i < indexes.size(); ++i)
+        area |= image->tileRect(indexes[i]);
+    return area;
+}
+
+/**
+ * @brief DrawCommand::countBytes - Memory held by the stored tiles. It is
+ *                                  counted whenever the storage or the
+ *                                  tiles change, and kept for byteSize(),
+ *                                  as looking at placeholders takes a lock.
+ */
+qint64 DrawCommand::countBytes() const
+{
+    switch(storage)
+    {
+        case compressed:
+            return data.size();
+        case in_memory:
+        {
+            qint64 total = 0;
+            for(int i = 0; i < storedCount(); ++i)
+            {
+                const QImage &tile = resized ? other.tile(i) : tiles.at(i);
+                if(!Canvas::solidColor(tile))
+                    total += qint64(tile.width()) * tile.height() * 4;
+            }
+            return total;
+        }
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief DrawCommand::compress - Pack the stored tiles with a fast zlib
+ *                                setting. They are unpacked the next time
+ *                                the command is undone or redone.
+ */
+void DrawCommand::compress()
+{
+    if(storage != in_memory)
+        return;
+
+    // tiles and their images share a layout, so the tiles are packed one
+    // after the other; placeholders stay where they are
+    QByteArray pixels;
+    pixels.reserve(byteSize());
+    for(int i = 0; i < storedCount(); ++i)
+    {
+        QImage &tile = storedTile(i);
+        if(Canvas::solidColor(tile))
+            continue;
+        pixels.append(reinterpret_cast<const char*>(tile.constBits()),
+                      tile.bytesPerLine() * tile.height());
+        tile = QImage();
+    }
+
+    data = qCompress(pixels, 1);
+    storage = compressed;
+    bytes = countBytes();
+}
+
+/**
+ * @brief DrawCommand::spill - Move the packed tiles to the journal. They
+ *                             are read back when the command is undone or
+ *                             redone.
+ */
+bool DrawCommand::spill(UndoJournal *journal)
+{
+    compress();
+    if(storage != compressed)
+        return storage != in_memory;
+
+    record = journal->append(data);
+    if(record < 0)
+        return false;
+
+    this->journal = journal;
+    data = QByteArray();
+    storage = spilled;
+    bytes = 0;
+    return true;
+}
+
+/**
+ * @brief DrawCommand::expire - Let go of the stored tiles. An expired
+ *                              command can no longer be undone or redone.
+ */
+void DrawCommand::expire()
+{
+    if(storage == spilled)
+        journal->release(record);
+
+    other = Canvas();
+    tiles.clear();
+    data = QByteArray();
+    project = 0;
+    storage = expired;
+    bytes = 0;
+}
+
+/**
+ * @brief DrawCommand::save - Writes which tiles the command swaps, and
+ *                            references to its tiles in the project. Tiles
+ *                            already in that project aren't looked at;
+ *                            packed, spilled or other projects' ones are
+ *                            unpacked to be added, then let go of again,
+ *                            leaving the command stored as it was until
+ *                            finishSave(). Returns false, having written
+ *                            nothing, if the tiles couldn't be read back
+ *                            and the command expired.
+ */
+bool DrawCommand::save(QDataStream &out, ProjectFile *project)
+{
+    savedTo = 0;
+    if(storage == in_project && this->project == project)
+    {
+        out << resized << indexes << data;
+        return true;
+    }
+
+    if(storage == expired)
+        return false;
+    if(storage != in_memory && !unpack())
+    {
+        expire();
+        return false;
+    }
+
+    QByteArray refs;
+    QDataStream stream(&refs, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    if(resized)
+        project->writeCanvas(stream, other);
+    else
+        for(int i = 0; i < tiles.size(); ++i)
+            stream << project->addTile(tiles.at(i));
+
+    out << resized << indexes << refs;
+
+    if(storage != in_memory)
+    {
+        release();
+        savedRefs = refs;
+        savedTo = project;
+    }
+    return true;
+}
+
+/**
+ * @brief DrawCommand::finishSave - Once the project a command was saved to
+ *                                  is written, tiles that weren't in memory
+ *                                  are left to it, and the packed copies,
+ *                                  journal record or other project are let
+ *                                  go of. If it wasn't written, or the
+ *                                  command has been undone or redone since,
+ *                                  it stays as it is.
+ */
+void DrawCommand::finishSave(ProjectFile *project, bool committed)
+{
+    if(savedTo != project)
+        return;
+
+    if(committed && storage != in_memory && storage != expired)
+    {
+        if(storage == spilled)
+            journal->release(record);
+        other = Canvas();
+        tiles.clear();
+        data = savedRefs;
+        this->project = project;
+        storage = in_project;
+        bytes = 0;
+    }
+    savedRefs = QByteArray();
+    savedTo = 0;
+}
+
+/**
+ * @brief DrawCommand::swap - Trade the stored tiles with the ones on the
+ *                            canvas
+ */
+void DrawCommand::swap()
+{
+    if(storage != in_memory && storage != expired)
+        load();
+    if(storage == expired)
+        return;
+
+    // the tiles traded may be placeholders where the others weren't
+    if(resized)
+        image->swap(other);
+    else
+        for(int i = 0; i < indexes.size(); ++i)
+            image->tile(indexes[i]).swap(tiles[i]);
+    bytes = countBytes();
+}
+
+/**
+ * @brief DrawCommand::load - Unpack the stored tiles and keep them in
+ *                            memory, letting go of where they were
+ */
+void DrawCommand::load()
+{
+    if(!unpack())
+    {
+        expire();
+        return;
+    }
+
+    if(storage == spilled)
+        journal->release(record);
+    data = QByteArray();
+    project = 0;
+    storage = in_memory;
+    bytes = countBytes();
+}
+
+/**
+ * @brief DrawCommand::unpack - Fill in the stored tiles from wherever they
+ *                              are kept, reading them back from the journal
+ *                              if they were paged out. Where they're kept
+ *                              is left alone. Returns false if what came
+ *                              back isn't all of them; the record or the
+ *                              project is damaged then.
+ */
+bool DrawCommand::unpack()
+{
+    if(storage == in_project)
+        return unpackProject();
+
+    QByteArray pixels = qUncompress(storage == spilled ? journal->read(record)
+                                                       : data);
+
+    // the tiles that were packed are the ones missing
+    qint64 packed = 0;
+    for(int i = 0; i < storedCount(); ++i)
+        if(storedTile(i).isNull())
+            packed += qint64(storedSize(i).width()) * storedSize(i).height() * 4;
+    if(pixels.size() != packed)
+        return false;
+
+    const uchar *bits = reinterpret_cast<const uchar*>(pixels.constData());
+    for(int i = 0; i < storedCount(); ++i)
+    {
+        QImage &tile = storedTile(i);
+        if(!tile.isNull())
+            continue;
+
+        QSize size = storedSize(i);
+        tile = QImage(bits, size.width(), size.height(),
+                      QImage::Format_ARGB32_Premultiplied).copy();
+        bits += size.width() * size.height() * 4;
+    }
+    return true;
+}
+
+/**
+ * @brief DrawCommand::unpackProject - Unpack the stored tiles from the
+ *                                     project they're in. Any tile missing
+ *                                     from it or damaged fails the lot.
+ */
+bool DrawCommand::unpackProject()
+{
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    if(resized)
+        other = project->readCanvas(in);
+    else
+    {
+        tiles.resize(indexes.size());
+        for(int i = 0; i < indexes.size(); ++i)
+        {
+            TileRef ref;
+            in >> ref;
+            tiles[i] = project->tile(ref, image->tileRect(indexes[i]).size());
+        }
+    }
+
+    bool whole = in.status() == QDataStream::Ok &&
+                 (!resized || !other.isNull());
+    for(int i = 0; whole && i < tiles.size(); ++i)
+        whole = !tiles.at(i).isNull();
+    if(!whole)
+        release();
+    return whole;
+}
+
+/**
+ * @brief DrawCommand::release - Drop the tiles unpacked from where they're
+ *                               kept, as they were before unpack(); those
+ *                               packed are the ones that aren't
+ *                               placeholders
+ */
+void DrawCommand::release()
+{
+    if(storage == in_project)
+    {
+        other = Canvas();
+        tiles.clear();
+        return;
+    }
+
+    for(int i = 0; i < storedCount(); ++i)
+    {
+        QImage &tile = storedTile(i);
+        if(!Canvas::solidColor(tile))
+            tile = QImage();
+    }
+}
+
+int DrawCommand::storedCount() const
+{
+    return resized ? other.tileCount() : tiles.size();
+}
+
+QImage& DrawCommand::storedTile(int i)
+{
+    return resized ? other.tile(i) : tiles[i];
+}
+
+/**
+ * @brief DrawCommand::storedSize - The size of a stored tile. The canvas
+ *                                  has the same layout as when the tiles
+ *                                  were stored.
+ */
+QSize DrawCommand::storedSize(int i) const
+{
+    return resized ? other.tileRect(i).size() : image->tileRect(indexes[i]).size();
 }
@@ -1,21 +1,89 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
-#include <QPixmap>
+#include <QImage>
 #include <QUndoCommand>
+#include <QVector>
 
+#include "canvas.h"
+
+
+class ProjectFile;
+class QDataStream;
+class UndoJournal;
 
 class DrawCommand : public QUndoCommand
 {
 public:
-    DrawCommand(const QPixmap &oldImage, QPixmap *image, QUndoCommand *parent = 0);
+    DrawCommand(const Canvas &oldImage, Canvas *image, const QRect &area,
+                QUndoCommand *parent = 0);
+
+    /** a command read back from a project, see save(); it's applied, and
+     *  its tiles are only unpacked when it's first undone */
+    DrawCommand(Canvas *image, QDataStream &in, ProjectFile *project,
+                QUndoCommand *parent = 0);
 
     void undo() override;
     void redo() override;
+
+    /** where the tiles that aren't on the canvas are kept */
+    enum Storage { in_memory, compressed, spilled, in_project, expired };
+    Storage getStorage() const { return storage; }
+
+    /** the part of the image that undo and redo change */
+    QRect getArea() const;
+
+    /** memory held by the stored tiles */
+    qint64 byteSize() const { return bytes; }
+
+    /** to stay within the undo budget: pack the tiles, page them out to
+     *  the journal, or drop them altogether */
+    void compress();
+    bool spill(UndoJournal *journal);
+    void expire();
+
+    /** write the command to a project's state, adding its tiles to the
+     *  project. False if they couldn't be read back, and the command
+     *  expired. Once the project is committed, or fails to be, tiles that
+     *  weren't in memory are left to it by finishSave() */
+    bool save(QDataStream &out, ProjectFile *project);
+    void finishSave(ProjectFile *project, bool committed);
+
 private:
-    QPixmap* image;
-    QPixmap oldImage;
-    QPixmap newImage;
+    void swap();
+    void load();
+    bool unpack();
+    bool unpackProject();
+    void release();
+
+    /** the tiles kept: the old image's when resized, otherwise the
+     *  changed ones */
+    int storedCount() const;
+    QImage& storedTile(int i);
+    QSize storedSize(int i) const;
+    qint64 countBytes() const;
+
+    Canvas* image;
+    bool resized;
+    bool applied;
+    Storage storage;
+    qint64 bytes;
+
+    /** the whole image when resized, otherwise just the changed tiles */
+    Canvas other;
+    QVector<int> indexes;
+    QVector<QImage> tiles;
+
+    /** packed tiles, in memory or in the journal, or the references to
+     *  the tiles in a project */
+    QByteArray data;
+    UndoJournal* journal;
+    int record;
+    ProjectFile* project;
+
+    /** the references written by the last save(), until it's finished */
+    QByteArray savedRefs;
+    ProjectFile* savedTo;
 };
 
 #endif // COMMANDS_H
@@ -8,28 +8,63 @@ const int DEFAULT_IMG_HEIGHT = 480;
 const int DEFAULT_PEN_THICKNESS = 1;
 const int DEFAULT_ERASER_THICKNESS = 10;
 const int DEFAULT_RECT_CURVE = 10;
+const int DEFAULT_FILL_TOLERANCE = 32;
 
 /** slider ranges */
 const int MIN_PEN_SIZE = 1;
 const int MAX_PEN_SIZE = 50;
 const int MIN_RECT_CURVE = 0;
 const int MAX_RECT_CURVE = 100;
+const int MIN_FILL_TOLERANCE = 0;
+const int MAX_FILL_TOLERANCE = 255;
 
 /** spinbox ranges */
 const int MIN_IMG_WIDTH = 1;
-const int MAX_IMG_WIDTH = 2560; // 2560x1440 limit due to undo/redo limitations
+const int MAX_IMG_WIDTH = 16384; // older undo history is paged out to disk
 const int MIN_IMG_HEIGHT = 1;
-const int MAX_IMG_HEIGHT = 1440;
+const int MAX_IMG_HEIGHT = 16384;
 
-/** max number of undo commands */
-const int UNDO_LIMIT = 100;
+/** distance between pen dabs, as a fraction of the pen width */
+const double DEFAULT_DAB_SPACING = 0.1;
 
-enum ToolType {pen, line, eraser, rect_tool};
+/** resizes bigger than this many pixels, before and after, show their
+ *  progress and can be canceled */
+const int RESIZE_PROGRESS_PIXELS = 8 * 1024 * 1024;
+
+/** likewise for images being loaded */
+const int LOAD_PROGRESS_PIXELS = 16 * 1024 * 1024;
+
+/** canvas tile width & height */
+const int TILE_SIZE = 128;
+
+/** viewport zoom range & the step taken by zoom in/out */
+const double MIN_ZOOM = 1.0 / 64;
+const double MAX_ZOOM = 32;
+const double ZOOM_STEP = 1.25;
+
+/** undo history memory budget, in megabytes */
+const int DEFAULT_UNDO_BUDGET = 256;
+const int MIN_UNDO_BUDGET = 16;
+const int MAX_UNDO_BUDGET = 4096;
+
+/** how much paged out undo history to keep on disk, in megabytes */
+const int UNDO_JOURNAL_LIMIT = 8192;
+
+/** autosave: a checkpoint after so many seconds or edits, whichever comes
+ *  first, but only as often as it can be written within a share of the
+ *  time (percent) and a rate of writing (KB/s) */
+const int AUTOSAVE_INTERVAL = 30;
+const int AUTOSAVE_EDITS = 20;
+const int AUTOSAVE_CPU_BUDGET = 5;
+const int AUTOSAVE_IO_BUDGET = 2048;
+
+enum ToolType {pen, line, eraser, rect_tool, fill_tool};
 enum LineStyle {solid, dashed, dotted, dash_dotted, dash_dot_dotted};
 enum CapStyle {flat, square, round_cap};
 enum DrawType {single, poly};
 enum ShapeType {rectangle, rounded_rectangle, ellipse};
 enum FillColor {foreground, background, no_fill};
 enum BoundaryType {miter_join, bevel_join, round_join};
+enum ResizeFilter {nearest_filter, bilinear_filter, bicubic_filter, lanczos3_filter};
 
 #endif // CONSTANTS_H
@@ -14,9 +14,22 @@
  * @brief CanvasSizeDialog::CanvasSizeDialog - Dialogue for creating a new
  *                                             canvas
  */
-CanvasSizeDialog::CanvasSizeDialog(QWidget* parent, const char* name, int width, int height)
+CanvasSizeDialog::CanvasSizeDialog(QWidget* parent, const char* name, int width, int height,
+                                   bool resampling)
     :QDialog(parent)
 {
+    // only resizing asks how to resample
+    filterComboBox = 0;
+    if(resampling)
+    {
+        filterComboBox = new QComboBox(this);
+        filterComboBox->addItem(tr("Nearest neighbor"), nearest_filter);
+        filterComboBox->addItem(tr("Bilinear"), bilinear_filter);
+        filterComboBox->addItem(tr("Bicubic"), bicubic_filter);
+        filterComboBox->addItem(tr("Lanczos"), lanczos3_filter);
+        filterComboBox->setCurrentIndex(bicubic_filter);
+    }
+
     QVBoxLayout *layout = new QVBoxLayout(this);
     layout->addWidget(createSpinBoxes(width,height));
     setLayout(layout);
@@ -56,6 +69,8 @@ QGroupBox* CanvasSizeDialog::createSpinBoxes(int width, int height)
     QFormLayout *spinBoxLayout = new QFormLayout(spinBoxesGroup);
     spinBoxLayout->addRow(tr("Width: "), widthSpinBox);
     spinBoxLayout->addRow(tr("Height: "), heightSpinBox);
+    if(filterComboBox)
+        spinBoxLayout->addRow(tr("Resampling: "), filterComboBox);
     spinBoxLayout->addRow(okButton);
     spinBoxLayout->addRow(cancelButton);
     spinBoxesGroup->setLayout(spinBoxLayout);
@@ -63,6 +78,17 @@ QGroupBox* CanvasSizeDialog::createSpinBoxes(int width, int height)
     return spinBoxesGroup;
 }
 
+/**
+ * @brief CanvasSizeDialog::getFilter - The resampling filter picked
+ *
+ */
+ResizeFilter CanvasSizeDialog::getFilter() const
+{
+    if(!filterComboBox)
+        return bicubic_filter;
+    return static_cast<ResizeFilter>(filterComboBox->currentData().toInt());
+}
+
 /**
  * @brief PenDialog::PenDialog - Dialogue for selecting pen size and cap style
  *
@@ -290,6 +316,31 @@ EraserDialog::EraserDialog(QWidget* parent, DrawArea* drawArea, int thickness)
     setLayout(vbox);
 }
 
+/**
+ * @brief FillDialog::FillDialog - Dialogue for choosing fill tolerance.
+ *
+ */
+FillDialog::FillDialog(QWidget* parent, DrawArea* drawArea, int tolerance)
+    :QDialog(parent)
+{
+    setWindowTitle(tr("Fill Dialog"));
+
+    this->drawArea = drawArea;
+
+    QLabel *toleranceLabel = new QLabel(tr("Color Tolerance"), this);
+    toleranceSlider = new QSlider(Qt::Horizontal, this);
+    toleranceSlider->setMinimum(MIN_FILL_TOLERANCE);
+    toleranceSlider->setMaximum(MAX_FILL_TOLERANCE);
+    toleranceSlider->setSliderPosition(tolerance);
+    toleranceSlider->setTracking(false);
+    connect(toleranceSlider, SIGNAL(valueChanged(int)), drawArea, SLOT(OnFillToleranceConfig(int)));
+
+    QVBoxLayout *vbox = new QVBoxLayout(this);
+    vbox->addWidget(toleranceLabel);
+    vbox->addWidget(toleranceSlider);
+    setLayout(vbox);
+}
+
 /**
  * @brief RectDialog::RectDialog - Dialogue for selecting what kind of rectangle to draw.
  *
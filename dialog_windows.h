@@ -6,6 +6,7 @@
 #include <QDialog>
 #include <QSlider>
 #include <QButtonGroup>
+#include <QComboBox>
 
 #include "constants.h"
 #include "tool.h"
@@ -20,16 +21,19 @@ class CanvasSizeDialog : public QDialog
 public:
     CanvasSizeDialog(QWidget* parent, const char* name = 0,
                      int width = DEFAULT_IMG_WIDTH,
-                     int height = DEFAULT_IMG_HEIGHT);
+                     int height = DEFAULT_IMG_HEIGHT,
+                     bool resampling = false);
 
     int getWidthValue() const { return widthSpinBox->value(); }
     int getHeightValue() const { return heightSpinBox->value(); }
+    ResizeFilter getFilter() const;
 
 private:
     QGroupBox* createSpinBoxes(int,int);
 
     QSpinBox *widthSpinBox;
     QSpinBox *heightSpinBox;
+    QComboBox *filterComboBox;
     QGroupBox *spinBoxesGroup;
 };
 
@@ -85,6 +89,19 @@ private:
     QSlider* eraserThicknessSlider;
 };
 
+class FillDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    FillDialog(QWidget* parent, DrawArea* drawArea,
+               int tolerance = DEFAULT_FILL_TOLERANCE);
+
+private:
+    DrawArea* drawArea;
+    QSlider* toleranceSlider;
+};
+
 class RectDialog : public QDialog
 {
     Q_OBJECT
@@ -1,10 +1,32 @@
+#include <QDataStream>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QGuiApplication>
 #include <QPainter>
 #include <QPaintEvent>
-
+#include <QProgressDialog>
+#include <QSaveFile>
+#include <QtConcurrent>
+#include <QScreen>
+#include <QtMath>
+#include <QTimer>
+#include <QWheelEvent>
+
+#include "autosave.h"
+#include "bmp_reader.h"
+#include "bmp_writer.h"
 #include "commands.h"
 #include "draw_area.h"
+#include "image_diff.h"
 #include "main_window.h"
+#include "project_file.h"
+#include "render_thread.h"
+#include "resample.h"
+#include "undo_journal.h"
+
 
+static QString writeImage(const Canvas &canvas, const QString &fileName);
 
 /**
  * @brief DrawArea::DrawArea - constructor for our Draw Area.
@@ -17,12 +39,14 @@ DrawArea::DrawArea(QWidget *parent)
 {
     // initialize the undo stack
     undoStack = new QUndoStack(this);
-    undoStack->setUndoLimit(UNDO_LIMIT);
+    firstLive = 0;
+    journal = new UndoJournal();
+    setUndoBudget(DEFAULT_UNDO_BUDGET);
 
     // initialize image
-    image = new QPixmap();
+    image = new Canvas();
 
-    //create the pen, line, eraser, & rect tools
+    //create the pen, line, eraser, rect, & fill tools
     createTools();
 
     // initialize colors
@@ -32,8 +56,32 @@ DrawArea::DrawArea(QWidget *parent)
     // initialize state variables
     drawing = false;
     drawingPoly = false;
+    previewing = false;
     currentLineMode = single;
 
+    // the image starts at the top left corner, at full size
+    zoom = 1;
+    panning = false;
+
+    // pen moves are drawn in batches, see queueStrokePoint()
+    flushTimer = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    connect(flushTimer, SIGNAL(timeout()), this, SLOT(OnFlushStroke()));
+    // strokes are rasterized on their own thread
+    stroke = 0;
+    renderer = new RenderThread(this);
+    connect(renderer, SIGNAL(resultsReady()), this, SLOT(OnRenderResults()));
+    // images are saved on a worker thread
+    saveWatcher = new QFutureWatcher<QString>(this);
+    connect(saveWatcher, SIGNAL(finished()), this, SLOT(OnSaveFinished()));
+    mapped = 0;
+    // a recovery journal is kept in the background
+    autosaver = new AutoSaver(this);
+    connect(autosaver, SIGNAL(checkpointDue()), this, SLOT(OnCheckpointDue()));
+    inputEvents = 0;
+    strokeBatches = 0;
+    framesPainted = 0;
+
     // small optimizations
     setAttribute(Qt::WA_OpaquePaintEvent);
     setAttribute(Qt::WA_StaticContents);
@@ -41,11 +89,25 @@ DrawArea::DrawArea(QWidget *parent)
 
 DrawArea::~DrawArea()
 {
+    // let a save in progress finish writing, and write the one waiting
+    // for it
+    saveWatcher->waitForFinished();
+    if(!queuedFile.isEmpty())
+        writeImage(queuedImage, queuedFile);
+    closeMapped();
+
+    // the commands refer to the image and the journal
+    delete stroke;
+    delete renderer;
+    delete undoStack;
+    qDeleteAll(projects);
+    delete journal;
     delete image;
     delete penTool;
     delete lineTool;
     delete eraserTool;
     delete rectTool;
+    delete fillTool;
 }
 
 
@@ -57,9 +119,49 @@ DrawArea::~DrawArea()
 void DrawArea::paintEvent(QPaintEvent *e)
 
 {
+    ++framesPainted;
+
     QPainter painter(this);
     QRect modifiedArea = e->rect(); // only need to redraw a small area
-    painter.drawPixmap(modifiedArea, *image, modifiedArea);
+
+    // around the image
+    if(!mapFromImage(image->rect()).contains(modifiedArea))
+        painter.fillRect(modifiedArea, palette().dark());
+
+    // the rest is drawn in image coordinates
+    QRect imageArea = mapToImage(modifiedArea).intersected(image->rect());
+    painter.translate(offset);
+    painter.scale(zoom, zoom);
+
+    int level = Mipmap::levelFor(zoom);
+    if(level == 0)
+    {
+        QVector<int> tiles = image->tilesIn(imageArea);
+        for(int i = 0; i < tiles.size(); ++i)
+        {
+            QRect tileRect = image->tileRect(tiles[i]);
+            QRect area = tileRect.intersected(imageArea);
+            painter.drawImage(area, image->tile(tiles[i]),
+                              area.translated(-tileRect.topLeft()));
+        }
+    }
+    else if(!imageArea.isEmpty())
+    {
+        // zoomed out, draw from the level closest to the screen's size
+        const QImage &mip = mipmap.level(level, imageArea, *image);
+        QRect source(QPoint(imageArea.left() >> level, imageArea.top() >> level),
+                     QPoint(imageArea.right() >> level, imageArea.bottom() >> level));
+
+        painter.save();
+        painter.scale(1 << level, 1 << level);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(source, mip, source);
+        painter.restore();
+    }
+
+    // the line or shape being dragged out isn't part of the image yet
+    if(previewing && mapFromImage(previewArea).intersects(modifiedArea))
+        currentTool->drawPreview(&painter, previewPoint);
 }
 
 /**
@@ -77,6 +179,12 @@ void DrawArea::mousePressEvent(QMouseEvent *e)
         // open the dialog menu
         static_cast<MainWindow*>(parent())->mousePressEvent(e);
     }
+    else if(e->button() == Qt::MiddleButton)
+    {
+        // drag the view around
+        panning = true;
+        panStart = e->pos();
+    }
     else if (e->button() == Qt::LeftButton)
     {
         if(image->isNull())
@@ -85,10 +193,17 @@ void DrawArea::mousePressEvent(QMouseEvent *e)
         drawing = true;
 
         if(!drawingPoly)
-            currentTool->setStartPoint(e->pos());
+            currentTool->setStartPoint(mapToImage(e->pos()));
 
-        // save a copy of the old image
-        oldImage = image->copy(QRect());
+        // one painter for the whole stroke, set up once; it hands the
+        // drawing to the render thread, which also keeps the old image
+        renderer->beginStroke();
+        stroke = new CanvasPainter(image, renderer);
+        currentTool->beginStroke(stroke);
+
+        // a fill happens once, where the button went down
+        if(currentTool->getType() == fill_tool)
+            currentTool->drawTo(mapToImage(e->pos()), stroke);
     }
 }
 
@@ -98,21 +213,40 @@ void DrawArea::mousePressEvent(QMouseEvent *e)
  */
 void DrawArea::mouseMoveEvent(QMouseEvent *e)
 {
+    if(panning)
+    {
+        offset += e->pos() - panStart;
+        panStart = e->pos();
+        update();
+        return;
+    }
+
     if (e->buttons() & Qt::LeftButton && drawing)
     {
         if(image->isNull())
             return;
 
+        ++inputEvents;
         ToolType type = currentTool->getType();
+        if(type == fill_tool)
+            return;
         if(type == line || type == rect_tool)
         {
-            *image = oldImage;
             if(type == line && currentLineMode == poly)
             {
                 drawingPoly = true;
             }
+
+            // only the overlay moves; the image is drawn on at release
+            QPoint point = mapToImage(e->pos());
+            QRect bounds = currentTool->previewBounds(point);
+            update(mapFromImage(previewArea | bounds));
+            previewing = true;
+            previewPoint = point;
+            previewArea = bounds;
+            return;
         }
-        currentTool->drawTo(e->pos(), this, image);
+        queueStrokePoint(mapToImage(e->pos()));
     }
 }
 
@@ -122,6 +256,9 @@ void DrawArea::mouseMoveEvent(QMouseEvent *e)
  */
 void DrawArea::mouseReleaseEvent(QMouseEvent *e)
 {
+    if(e->button() == Qt::MiddleButton)
+        panning = false;
+
     if (e->button() == Qt::LeftButton && drawing)
     {
         drawing = false;
@@ -129,18 +266,28 @@ void DrawArea::mouseReleaseEvent(QMouseEvent *e)
         if(image->isNull())
             return;
 
+        // finish what's left of the last batch before the final point
+        OnFlushStroke();
+
+        // commit the previewed shape where it was last shown
+        if(previewing)
+        {
+            currentTool->drawTo(previewPoint, stroke);
+        }
+
         if(drawingPoly)
         {
-            currentTool->setStartPoint(e->pos());
+            currentTool->setStartPoint(mapToImage(e->pos()));
             //return;
         }
         if(currentTool->getType() == pen)
-            currentTool->drawTo(e->pos(), this, image);
+            currentTool->drawTo(mapToImage(e->pos()), stroke);
 
-        // for undo/redo - make sure there was a change
-        // (in case drawing began off-image)
-        if(oldImage.toImage() != image->toImage())
-            saveDrawCommand(oldImage);
+        // the undo command is made once the render thread is done,
+        // see OnRenderResults()
+        delete stroke;
+        stroke = 0;
+        renderer->endStroke();
     }
 }
 
@@ -157,17 +304,63 @@ void DrawArea::mouseDoubleClickEvent(QMouseEvent *e)
     }
 }
 
+/**
+ * @brief DrawArea::wheelEvent - ctrl+wheel zooms around the cursor, the
+ *                               wheel alone scrolls the view
+ *
+ */
+void DrawArea::wheelEvent(QWheelEvent *e)
+{
+    if(e->modifiers() & Qt::ControlModifier)
+    {
+        qreal steps = e->angleDelta().y() / 120.0;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        const QPoint pos = e->position().toPoint();
+#else
+        const QPoint pos = e->pos();
+#endif
+        zoomAt(zoom * qPow(ZOOM_STEP, steps), pos);
+    }
+    else
+    {
+        offset += QPointF(e->angleDelta()) / 4;
+        update();
+    }
+}
+
 /**
  * @brief DrawArea::OnSaveImage - Undo a previous action
  *
  */
 void DrawArea::OnUndo()
 {
+    // the stroke's painters are still open on the tiles
+    if(drawing)
+        return;
+    finishRendering();
     if(!undoStack->canUndo())
         return;
 
+    // the oldest commands may have expired to stay within the budget
+    DrawCommand *command = undoCommand(undoStack->index() - 1);
+    if(command->getStorage() == DrawCommand::expired)
+        return;
+
     undoStack->undo();
-    update();
+
+    // a command that can't be read back expires without changing the
+    // image, along with every one before it
+    if(command->getStorage() == DrawCommand::expired)
+    {
+        undoStack->redo();
+        expireUpTo(undoStack->index() - 1);
+        return;
+    }
+
+    renderer->reset(*image);
+    updateImage(command->getArea());
+    trimUndoHistory();
+    autosaver->imageChanged();
 }
 
 /**
@@ -176,11 +369,32 @@ void DrawArea::OnUndo()
  */
 void DrawArea::OnRedo()
 {
+    if(drawing)
+        return;
+    finishRendering();
     if(!undoStack->canRedo())
         return;
 
+    // commands undone may have expired to stay within the budget too
+    DrawCommand *command = undoCommand(undoStack->index());
+    if(command->getStorage() == DrawCommand::expired)
+        return;
+
     undoStack->redo();
-    update();
+
+    // and redoing one that can't be read back leaves every one after it
+    // out of reach
+    if(command->getStorage() == DrawCommand::expired)
+    {
+        undoStack->undo();
+        expireAround(undoStack->index());
+        return;
+    }
+
+    renderer->reset(*image);
+    updateImage(command->getArea());
+    trimUndoHistory();
+    autosaver->imageChanged();
 }
 
 /**
@@ -189,12 +403,95 @@ void DrawArea::OnRedo()
  */
 void DrawArea::OnClearAll()
 {
-    if(image->isNull())
+    if(image->isNull() || drawing)
         return;
 
     clearImage();
 }
 
+/**
+ * @brief DrawArea::OnFlushStroke - Draw the pen moves collected since the
+ *                                  last batch as one polyline
+ *
+ */
+void DrawArea::OnFlushStroke()
+{
+    flushTimer->stop();
+    if(pendingPoints.isEmpty() || !stroke)
+        return;
+
+    currentTool->drawThrough(pendingPoints, stroke);
+    pendingPoints.clear();
+    ++strokeBatches;
+    sinceFlush.start();
+}
+
+/**
+ * @brief DrawArea::OnRenderResults - Show the tiles the render thread has
+ *                                    drawn, and put each stroke it has
+ *                                    finished on the undo stack, in order
+ *
+ */
+void DrawArea::OnRenderResults()
+{
+    QRect area = renderer->takeTiles(image);
+    if(!area.isEmpty())
+        updateImage(area);
+
+    Canvas before, after;
+    QRect strokeArea;
+    while(renderer->takeFinishedStroke(&before, &after, &strokeArea))
+    {
+        // for undo/redo - make sure there was a change
+        // (in case drawing began off-image), only looking
+        // at the area the tool drew on; the image may already show
+        // later strokes, so the stroke is compared with what it left
+        if(!strokeArea.isEmpty())
+        {
+            QRect changed = changedArea(before, after, strokeArea);
+            if(!changed.isEmpty())
+                saveDrawCommand(before, changed);
+        }
+
+        // the line or shape is on the image now, or was dragged entirely
+        // off it and drew nothing; either way the preview is done
+        if(previewing && !drawing)
+        {
+            previewing = false;
+            update(mapFromImage(previewArea));
+        }
+    }
+}
+
+/**
+ * @brief DrawArea::OnZoomIn - Zoom in around the middle of the view
+ *
+ */
+void DrawArea::OnZoomIn()
+{
+    zoomAt(zoom * ZOOM_STEP, QRectF(rect()).center());
+}
+
+/**
+ * @brief DrawArea::OnZoomOut - Zoom out around the middle of the view
+ *
+ */
+void DrawArea::OnZoomOut()
+{
+    zoomAt(zoom / ZOOM_STEP, QRectF(rect()).center());
+}
+
+/**
+ * @brief DrawArea::OnZoomReset - Back to full size, image at the top left
+ *
+ */
+void DrawArea::OnZoomReset()
+{
+    zoom = 1;
+    offset = QPointF();
+    update();
+}
+
 /**
  * @brief DrawArea::OnPenCapConfig - Update cap style for pen tool
  *
@@ -366,6 +663,15 @@ void DrawArea::OnRectCurveConfig(int value)
     rectTool->setCurve(value);
 }
 
+/**
+ * @brief DrawArea::OnFillToleranceConfig - Update fill tolerance
+ *
+ */
+void DrawArea::OnFillToleranceConfig(int value)
+{
+    fillTool->setTolerance(value);
+}
+
 /**
  * @brief DrawArea::createNewImage - creates a new image of
  *                                   user-specified dimensions
@@ -374,15 +680,53 @@ void DrawArea::OnRectCurveConfig(int value)
 void DrawArea::createNewImage(const QSize &size)
 {
     // save a copy of the old image
-    oldImage = image->copy();
+    finishRendering();
+    closeMapped();
+    oldImage = *image;
 
-    *image = QPixmap(size);
-    image->fill(backgroundColor);
-    update();
+    *image = Canvas(size, backgroundColor);
+    renderer->reset(*image);
+    updateImage(image->rect());
 
     // for undo/redo
-    if(!imagesEqual(oldImage, *image))
-        saveDrawCommand(oldImage);
+    QRect area = changedArea(oldImage, *image);
+    if(!area.isEmpty())
+        saveDrawCommand(oldImage, area);
+}
+
+/**
+ * @brief DrawArea::runBands - Runs work on each of count bands on the
+ *                             thread pool, keeping the event loop going
+ *                             while the progress dialog counts them off.
+ *                             Returns false if the user canceled.
+ *
+ */
+template<class Work>
+bool DrawArea::runBands(QProgressDialog &progress, int count, Work work)
+{
+    QVector<int> bands;
+    for(int i = 0; i < count; ++i)
+        bands.append(i);
+
+    progress.setRange(0, count);
+    progress.setValue(0);
+
+    QFutureWatcher<void> watcher;
+    QEventLoop loop;
+    connect(&watcher, SIGNAL(progressValueChanged(int)),
+            &progress, SLOT(setValue(int)));
+    connect(&progress, SIGNAL(canceled()), &watcher, SLOT(cancel()));
+    connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+
+    watcher.setFuture(QtConcurrent::map(bands, [&work](int &band) {
+        work(band);
+    }));
+
+    if(!watcher.isFinished())
+        loop.exec();
+    watcher.waitForFinished();
+
+    return !watcher.isCanceled();
 }
 
 /**
@@ -390,35 +734,432 @@ void DrawArea::createNewImage(const QSize &size)
  *
  */
 void DrawArea::loadImage(const QString &fileName)
+{
+    finishRendering();
+
+    // BMPs are decoded from the file straight into the tiles, anything
+    // else through a QImage
+    BmpReader reader(fileName);
+    Canvas loaded;
+    if(!reader.open())
+        loaded = Canvas(QImage(fileName));
+    else if(readBmp(reader))
+        loaded = reader.result();
+    else
+        return;
+
+    closeMapped();
+    setImage(loaded);
+}
+
+/**
+ * @brief DrawArea::openMapped - Load a BMP and keep its file mapped, so
+ *                               saving back to it only writes the tiles
+ *                               changed since. Returns an error message if
+ *                               the file can't be edited in place.
+ *
+ */
+QString DrawArea::openMapped(const QString &fileName)
+{
+    finishRendering();
+
+    // a save still being written would replace the file after it's
+    // mapped, and the edits would go to the old one
+    if(isSaving(fileName))
+        return tr("The file is still being saved. Try again once it's done.");
+
+    BmpReader *reader = new BmpReader(fileName, QIODevice::ReadWrite);
+    if(!reader->open())
+    {
+        QString error = reader->errorString();
+        delete reader;
+        return error;
+    }
+    if(!readBmp(*reader))
+    {
+        delete reader;
+        return QString();
+    }
+
+    closeMapped();
+    mapped = reader;
+    setImage(reader->result());
+    return QString();
+}
+
+/**
+ * @brief DrawArea::restoreImage - Puts back an image recovered after a
+ *                                 crash, as one step of the undo history
+ *
+ */
+void DrawArea::restoreImage(const Canvas &canvas)
+{
+    finishRendering();
+    closeMapped();
+    setImage(canvas);
+}
+
+/**
+ * @brief DrawArea::closeMapped - Stop editing a file in place, letting go
+ *                                of the map and the copy of its tiles
+ *
+ */
+void DrawArea::closeMapped()
+{
+    delete mapped;
+    mapped = 0;
+}
+
+/**
+ * @brief DrawArea::readBmp - Decodes an opened BMP on every core, with a
+ *                            progress dialog if it's big. Returns false if
+ *                            the user canceled.
+ *
+ */
+bool DrawArea::readBmp(BmpReader &reader)
+{
+    if(qint64(reader.size().width()) * reader.size().height() <
+       LOAD_PROGRESS_PIXELS)
+    {
+        reader.readAll();
+        return true;
+    }
+
+    QProgressDialog progress(this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setAutoReset(false);
+    progress.setMinimumDuration(0);
+    progress.setLabelText(tr("Loading image..."));
+
+    return runBands(progress, reader.bands(), [&reader](int band) {
+        reader.readBand(band);
+    });
+}
+
+/**
+ * @brief DrawArea::setImage - Replaces the whole image, as one step of
+ *                             the undo history. Rendering must be done.
+ *
+ */
+void DrawArea::setImage(const Canvas &canvas)
 {
     // save a copy of the old image
-    oldImage = image->copy();
+    oldImage = *image;
 
-    image->load(fileName);
-    update();
+    *image = canvas;
+    renderer->reset(*image);
+    updateImage(image->rect());
 
     // for undo/redo
-    if(!imagesEqual(oldImage, *image))
-        saveDrawCommand(oldImage);
+    QRect area = changedArea(oldImage, *image);
+    if(!area.isEmpty())
+        saveDrawCommand(oldImage, area);
 }
 
 /**
- * @brief DrawArea::saveImage - Save an image to user-specified file
+ * @brief DrawArea::openProject - Opens a project file: its image, and its
+ *                                undo history in place of this one. The
+ *                                history's tiles are left in the file
+ *                                until they're undone to. Returns an
+ *                                error message if it can't be opened.
+ *
+ */
+QString DrawArea::openProject(const QString &fileName)
+{
+    finishRendering();
+
+    ProjectFile *project = new ProjectFile(fileName);
+    if(!project->open())
+    {
+        QString error = project->errorString();
+        delete project;
+        return error;
+    }
+
+    // the image as it was with every command applied, the commands, and
+    // how many of them were applied
+    QByteArray state = project->state();
+    QDataStream in(state);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    Canvas canvas = project->readCanvas(in);
+    qint32 count = 0, index = 0;
+    in >> count >> index;
+
+    QList<DrawCommand*> commands;
+    for(int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+        commands.append(new DrawCommand(image, in, project));
+
+    if(canvas.isNull() || in.status() != QDataStream::Ok ||
+       index < 0 || index > count)
+    {
+        qDeleteAll(commands);
+        delete project;
+        return tr("The project file is damaged.");
+    }
+
+    // the old history goes, with the journal records and projects it used
+    closeMapped();
+    for(int i = 0; i < undoStack->count(); ++i)
+        undoCommand(i)->expire();
+    undoStack->clear();
+    firstLive = 0;
+    qDeleteAll(projects);
+    projects.clear();
+    projects.append(project);
+
+    // pushing an applied command doesn't draw it again; undoing back to
+    // where the project was unpacks the tiles of the commands undone. One
+    // whose tiles are missing from the file expires without changing the
+    // image, so the image stays where it got to, and the history before
+    // it goes
+    *image = canvas;
+    for(int i = 0; i < commands.size(); ++i)
+        undoStack->push(commands[i]);
+    while(undoStack->index() > index)
+    {
+        DrawCommand *command = undoCommand(undoStack->index() - 1);
+        undoStack->undo();
+        if(command->getStorage() == DrawCommand::expired)
+        {
+            undoStack->redo();
+            expireUpTo(undoStack->index() - 1);
+            break;
+        }
+    }
+
+    renderer->reset(*image);
+    updateImage(image->rect());
+    trimUndoHistory();
+    autosaver->imageChanged();
+    return QString();
+}
+
+/**
+ * @brief DrawArea::saveProject - Saves the image and its undo history as
+ *                                a project. Saving to a project that's
+ *                                open appends just the tiles it doesn't
+ *                                have yet. Returns an error message if it
+ *                                couldn't be written.
+ *
+ */
+QString DrawArea::saveProject(const QString &fileName)
+{
+    finishRendering();
+
+    ProjectFile *project = 0;
+    for(int i = 0; i < projects.size(); ++i)
+        if(QFileInfo(projects[i]->fileName()).absoluteFilePath() ==
+           QFileInfo(fileName).absoluteFilePath())
+            project = projects[i];
+
+    // a new project is only kept once it's written
+    const bool created = !project;
+    if(created)
+    {
+        project = new ProjectFile(fileName);
+        if(!project->create())
+        {
+            QString error = project->errorString();
+            delete project;
+            return error;
+        }
+    }
+
+    // the image is saved with every command that can be redone applied,
+    // so that opening it only ever undoes; the commands past one that
+    // expired can't be reached and are left out
+    const int index = undoStack->index();
+    while(undoStack->canRedo())
+    {
+        DrawCommand *command = undoCommand(undoStack->index());
+        if(command->getStorage() == DrawCommand::expired)
+            break;
+        undoStack->redo();
+        if(command->getStorage() == DrawCommand::expired)
+        {
+            undoStack->undo();
+            expireAround(undoStack->index());
+            break;
+        }
+    }
+    const int end = undoStack->index();
+
+    // expired commands can't be undone, so the history starts after them;
+    // a command whose tiles can't be read back expires as it is saved, and
+    // the history is written again starting after it
+    QByteArray state;
+    int first = firstLive;
+    bool complete = false;
+    while(!complete)
+    {
+        first = firstLive;
+        for(int i = firstLive; i < end; ++i)
+            if(undoCommand(i)->getStorage() == DrawCommand::expired)
+                first = i + 1;
+
+        state.clear();
+        QDataStream out(&state, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_0);
+        project->writeCanvas(out, *image);
+        out << qint32(end - first)
+            << qint32(qMax(index, first) - first);
+
+        complete = true;
+        for(int i = first; complete && i < end; ++i)
+            complete = undoCommand(i)->save(out, project);
+    }
+
+    undoStack->setIndex(index);
+
+    // the commands saved only leave their tiles to the project once it is
+    // written, so a save that fails loses nothing
+    const bool committed = project->commit(state);
+    for(int i = firstLive; i < end; ++i)
+        undoCommand(i)->finishSave(project, committed && i >= first);
+
+    if(!committed)
+    {
+        QString error = project->errorString();
+        if(created)
+            delete project;
+        return error;
+    }
+    if(created)
+        projects.append(project);
+    return QString();
+}
+
+/**
+ * @brief writeImage - Streams the canvas as a BMP to a temporary file,
+ *                     which only replaces fileName once all of it is
+ *                     written. Returns an error message, or an empty
+ *                     string if it worked.
+ *
+ */
+static QString writeImage(const Canvas &canvas, const QString &fileName)
+{
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+        return file.errorString();
+
+    QString error = writeBmp(canvas, &file);
+    if(!error.isEmpty())
+    {
+        file.cancelWriting();
+        return error;
+    }
+    if(!file.commit())
+        return file.errorString();
+    return QString();
+}
+
+/**
+ * @brief DrawArea::saveImage - Save an image to user-specified file. The
+ *                              canvas is copied, which only shares its
+ *                              tiles, and written out on a worker thread;
+ *                              drawing goes on meanwhile. imageSaved() is
+ *                              emitted once the file is written.
+ *
+ *                              One save is written at a time. A save asked
+ *                              for while one is being written waits for it
+ *                              to finish; only the latest one waiting is
+ *                              kept, see OnSaveFinished().
  *
  */
 void DrawArea::saveImage(const QString &fileName)
 {
-    image->save(fileName, "BMP");
+    finishRendering();
+
+    // a file being edited in place only has the tiles changed since it
+    // was opened or last saved written back; if it can't be, e.g. after a
+    // resize, it is replaced like any other
+    if(mapped && QFileInfo(fileName).absoluteFilePath() ==
+                 QFileInfo(mapped->fileName()).absoluteFilePath())
+    {
+        if(mapped->writeChanges(*image) >= 0)
+        {
+            emit imageSaved(fileName, QString());
+            return;
+        }
+        closeMapped();
+    }
+
+    if(saveWatcher->isRunning())
+    {
+        queuedImage = *image;
+        queuedFile = fileName;
+        return;
+    }
+    startSave(*image, fileName);
+}
+
+/**
+ * @brief DrawArea::isSaving - Whether a save being written, or waiting to
+ *                             be, is going to replace a file
+ *
+ */
+bool DrawArea::isSaving(const QString &fileName) const
+{
+    QString path = QFileInfo(fileName).absoluteFilePath();
+    return (saveWatcher->isRunning() &&
+            QFileInfo(savingTo).absoluteFilePath() == path) ||
+           (!queuedFile.isEmpty() &&
+            QFileInfo(queuedFile).absoluteFilePath() == path);
+}
+
+/**
+ * @brief DrawArea::startSave - Write a copy of the canvas on the thread
+ *                              pool
+ *
+ */
+void DrawArea::startSave(const Canvas &canvas, const QString &fileName)
+{
+    savingTo = fileName;
+    saveWatcher->setFuture(QtConcurrent::run(writeImage, canvas, fileName));
+}
+
+/**
+ * @brief DrawArea::OnCheckpointDue - Hand the autosave the image, unless
+ *                                    a stroke is being drawn; it asks
+ *                                    again later
+ *
+ */
+void DrawArea::OnCheckpointDue()
+{
+    if(drawing || image->isNull())
+        return;
+    autosaver->checkpoint(*image);
 }
 
 /**
- * @brief DrawArea::resizeImage - Resize image to user-specified dimensions
+ * @brief DrawArea::OnSaveFinished - Pass on how the save went, then start
+ *                                   the save waiting for it, if any
  *
  */
-void DrawArea::resizeImage(const QSize &size)
+void DrawArea::OnSaveFinished()
+{
+    emit imageSaved(savingTo, saveWatcher->result());
+
+    if(queuedFile.isEmpty())
+        return;
+    Canvas canvas = queuedImage;
+    QString fileName = queuedFile;
+    queuedImage = Canvas();
+    queuedFile.clear();
+    startSave(canvas, fileName);
+}
+
+/**
+ * @brief DrawArea::resizeImage - Resize image to user-specified dimensions,
+ *                                resampled with the filter picked
+ *
+ */
+void DrawArea::resizeImage(const QSize &size, ResizeFilter filter)
 {
     // save a copy of the old image
-    oldImage = image->copy();
+    finishRendering();
+    oldImage = *image;
 
     // if no change, do nothing
     if(image->size() == size)
@@ -426,12 +1167,53 @@ void DrawArea::resizeImage(const QSize &size)
         return;
     }
 
-    // else re-scale the image
-    *image = image->scaled(size, Qt::IgnoreAspectRatio);
-    update();
+    // else re-scale the image, on every core
+    QImage scaled;
+    if(qint64(image->width()) * image->height() +
+       qint64(size.width()) * size.height() < RESIZE_PROGRESS_PIXELS)
+    {
+        scaled = Resampler::scaled(image->toImage(), size, filter);
+    }
+    else
+    {
+        Resampler resampler(image->toImage(), size, filter);
+        if(!resample(resampler))
+            return;
+        scaled = resampler.result();
+    }
+
+    *image = Canvas(scaled);
+    renderer->reset(*image);
+    updateImage(image->rect());
 
     // for undo/redo
-    saveDrawCommand(oldImage);
+    saveDrawCommand(oldImage, image->rect());
+}
+
+/**
+ * @brief DrawArea::resample - Runs the passes of a big resize on the thread
+ *                             pool, one after the other, while a progress
+ *                             dialog counts the bands done. Returns false
+ *                             if the user canceled.
+ *
+ */
+bool DrawArea::resample(Resampler &resampler)
+{
+    QProgressDialog progress(this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setAutoReset(false);
+    progress.setMinimumDuration(0);
+
+    progress.setLabelText(tr("Resizing image (pass 1 of 2)..."));
+    if(!runBands(progress, resampler.horizontalBands(), [&resampler](int band) {
+        resampler.horizontalPass(band);
+    }))
+        return false;
+
+    progress.setLabelText(tr("Resizing image (pass 2 of 2)..."));
+    return runBands(progress, resampler.verticalBands(), [&resampler](int band) {
+        resampler.verticalPass(band);
+    });
 }
 
 /**
@@ -442,14 +1224,17 @@ void DrawArea::resizeImage(const QSize &size)
 void DrawArea::clearImage()
 {
     // save a copy of the old image
-    oldImage = image->copy();
+    finishRendering();
+    oldImage = *image;
 
     image->fill(backgroundColor);
-    update(image->rect());
+    renderer->reset(*image);
+    updateImage(image->rect());
 
     // for undo/redo
-    if(!imagesEqual(oldImage, *image))
-        saveDrawCommand(oldImage);
+    QRect area = changedArea(oldImage, *image);
+    if(!area.isEmpty())
+        saveDrawCommand(oldImage, area);
 }
 
 /**
@@ -465,6 +1250,7 @@ void DrawArea::updateColorConfig(const QColor &color, int which)
          penTool->setColor(foregroundColor);
          lineTool->setColor(foregroundColor);
          rectTool->setColor(foregroundColor);
+         fillTool->setColor(foregroundColor);
 
          if(rectTool->getFillMode() == foreground)
              rectTool->setFillColor(foregroundColor);
@@ -502,6 +1288,7 @@ Tool* DrawArea::setCurrentTool(int newType)
         case line: currentTool = lineTool;      break;
         case eraser: currentTool = eraserTool;  break;
         case rect_tool: currentTool = rectTool; break;
+        case fill_tool: currentTool = fillTool; break;
         default:                                break;
     }
     return currentTool;
@@ -520,16 +1307,243 @@ void DrawArea::setLineMode(const DrawType mode)
     currentLineMode = mode;
 }
 
+/**
+ * @brief DrawArea::setUndoBudget - Sets how much memory the undo history
+ *                                  may use before old commands expire
+ *
+ */
+void DrawArea::setUndoBudget(int megabytes)
+{
+    undoBudget = qint64(megabytes) * 1024 * 1024;
+    trimUndoHistory();
+}
+
 /**
  * @brief DrawArea::SaveDrawCommand - Put together a DrawCommand
  *                                  and save it on the undo/redo stack.
+ *                                  Only the modified area is kept.
  *
  */
-void DrawArea::saveDrawCommand(const QPixmap &old_image)
+void DrawArea::saveDrawCommand(const Canvas &old_image, const QRect &area)
 {
-    // put the old and new image on the stack for undo/redo
-    QUndoCommand *drawCommand = new DrawCommand(old_image, image);
+    // put the old and new image area on the stack for undo/redo
+    QUndoCommand *drawCommand = new DrawCommand(old_image, image, area);
     undoStack->push(drawCommand);
+    trimUndoHistory();
+    autosaver->imageChanged();
+}
+
+/**
+ * @brief DrawArea::updateImage - Everything that changes the image reports
+ *                                the area here, so the mipmaps only redo
+ *                                that area and only it is repainted
+ *
+ */
+void DrawArea::updateImage(const QRect &area)
+{
+    if(mipmap.size() != image->size())
+    {
+        mipmap.reset(image->size());
+        update();
+        return;
+    }
+    mipmap.invalidate(area);
+    update(mapFromImage(area));
+}
+
+/**
+ * @brief DrawArea::mapToImage - The image pixel under a point of the widget
+ *
+ */
+QPoint DrawArea::mapToImage(const QPoint &pos) const
+{
+    return QPoint(qFloor((pos.x() - offset.x()) / zoom),
+                  qFloor((pos.y() - offset.y()) / zoom));
+}
+
+/**
+ * @brief DrawArea::mapToImage - The image pixels under an area of the widget
+ *
+ */
+QRect DrawArea::mapToImage(const QRect &area) const
+{
+    return QRectF((area.x() - offset.x()) / zoom, (area.y() - offset.y()) / zoom,
+                  area.width() / zoom, area.height() / zoom).toAlignedRect();
+}
+
+/**
+ * @brief DrawArea::mapFromImage - The widget area covering some image pixels
+ *
+ */
+QRect DrawArea::mapFromImage(const QRect &area) const
+{
+    return QRectF(area.x() * zoom + offset.x(), area.y() * zoom + offset.y(),
+                  area.width() * zoom, area.height() * zoom).toAlignedRect();
+}
+
+/**
+ * @brief DrawArea::finishRendering - Let the render thread catch up and
+ *                                    take its results. Anything that
+ *                                    changes the image other than a stroke
+ *                                    comes through here first, so it sees
+ *                                    every stroke drawn & on the undo stack.
+ *
+ */
+void DrawArea::finishRendering()
+{
+    renderer->waitForIdle();
+    OnRenderResults();
+}
+
+/**
+ * @brief DrawArea::queueStrokePoint - Collect a pen move. The batch is drawn
+ *                                     as soon as the events already queued
+ *                                     have been read, unless the last one
+ *                                     went out less than a display frame
+ *                                     ago; then it waits out the frame. So
+ *                                     a 1000 Hz mouse costs one batch per
+ *                                     frame, and a slow one draws at once.
+ *
+ */
+void DrawArea::queueStrokePoint(const QPoint &point)
+{
+    pendingPoints.append(point);
+    if(flushTimer->isActive())
+        return;
+
+    qreal rate = QGuiApplication::primaryScreen()->refreshRate();
+    int frame = qMax(1, qRound(1000 / (rate > 0 ? rate : 60)));
+    qint64 wait = sinceFlush.isValid() ? frame - sinceFlush.elapsed() : 0;
+    flushTimer->start(int(qBound(qint64(0), wait, qint64(frame))));
+}
+
+/**
+ * @brief DrawArea::zoomAt - Change the zoom, keeping the image pixel under
+ *                           the anchor where it is
+ *
+ */
+void DrawArea::zoomAt(qreal newZoom, const QPointF &anchor)
+{
+    newZoom = qBound(MIN_ZOOM, newZoom, MAX_ZOOM);
+    offset = anchor - (anchor - offset) * (newZoom / zoom);
+    zoom = newZoom;
+    update();
+}
+
+/**
+ * @brief DrawArea::getUndoMemoryUsage - Memory held by the undo history,
+ *                                       not counting the journal
+ *
+ */
+qint64 DrawArea::getUndoMemoryUsage() const
+{
+    qint64 total = 0;
+    for(int i = firstLive; i < undoStack->count(); ++i)
+        total += undoCommand(i)->byteSize();
+    return total;
+}
+
+/**
+ * @brief DrawArea::trimUndoHistory - Compress the commands furthest from
+ *                                    where the history is until it fits in
+ *                                    its budget, page them out to the
+ *                                    journal if that isn't enough, and
+ *                                    expire them once the journal is full
+ *                                    as well. The oldest commands done go
+ *                                    first, then the commands undone, the
+ *                                    last one undone last. The command
+ *                                    that was done last and the one undone
+ *                                    last are always kept as they are, so
+ *                                    they can be undone or redone right
+ *                                    away.
+ *
+ *                                    Commands before firstLive are expired
+ *                                    and aren't looked at again, so a push
+ *                                    only costs as much as the history
+ *                                    that can still be undone.
+ *
+ */
+void DrawArea::trimUndoHistory()
+{
+    const int last = undoStack->index() - 1;
+    const int next = undoStack->index();
+
+    // a command that couldn't be read back when undone expired on its own
+    for(int i = last; i >= firstLive; --i)
+        if(undoCommand(i)->getStorage() == DrawCommand::expired)
+        {
+            expireUpTo(i);
+            break;
+        }
+
+    QVector<int> order;
+    for(int i = firstLive; i < last; ++i)
+        order.append(i);
+    for(int i = undoStack->count() - 1; i > next; --i)
+        order.append(i);
+
+    qint64 total = getUndoMemoryUsage();
+
+    for(int i = 0; i < order.size() && total > undoBudget; ++i)
+    {
+        DrawCommand *command = undoCommand(order[i]);
+        total -= command->byteSize();
+        command->compress();
+        total += command->byteSize();
+    }
+
+    for(int i = 0; i < order.size() && total > undoBudget; ++i)
+    {
+        DrawCommand *command = undoCommand(order[i]);
+        total -= command->byteSize();
+        if(!command->spill(journal))
+            expireAround(order[i]);
+    }
+
+    const qint64 journalLimit = qint64(UNDO_JOURNAL_LIMIT) * 1024 * 1024;
+    for(int i = 0; i < order.size() && journal->liveBytes() > journalLimit; ++i)
+        expireAround(order[i]);
+}
+
+/**
+ * @brief DrawArea::expireAround - Expire a command along with the ones that
+ *                                 can't be reached past it: every one
+ *                                 before it if it is done, every one after
+ *                                 it if it is undone
+ *
+ */
+void DrawArea::expireAround(int index)
+{
+    if(index < undoStack->index())
+    {
+        expireUpTo(index);
+        return;
+    }
+    for(int i = index; i < undoStack->count(); ++i)
+        undoCommand(i)->expire();
+}
+
+/**
+ * @brief DrawArea::expireUpTo - Expire a command and every one before it,
+ *                               as undo can't get past it anyway
+ *
+ */
+void DrawArea::expireUpTo(int index)
+{
+    for(int i = firstLive; i <= index; ++i)
+        undoCommand(i)->expire();
+    firstLive = qMax(firstLive, index + 1);
+}
+
+/**
+ * @brief DrawArea::undoCommand - Get a command off the undo stack
+ *
+ */
+DrawCommand* DrawArea::undoCommand(int index) const
+{
+    // the stack only hands out const commands, but they are ours
+    return const_cast<DrawCommand*>(
+                static_cast<const DrawCommand*>(undoStack->command(index)));
 }
 
 /**
@@ -543,16 +1557,87 @@ void DrawArea::createTools()
     lineTool = new LineTool(QBrush(Qt::black), DEFAULT_PEN_THICKNESS);
     eraserTool = new EraserTool(QBrush(Qt::white), DEFAULT_ERASER_THICKNESS);
     rectTool = new RectTool(QBrush(Qt::black), DEFAULT_PEN_THICKNESS);
+    fillTool = new FillTool(QBrush(Qt::black));
 
     // set default tool
     currentTool = static_cast<Tool*>(penTool);
 }
 
+/**
+ * @brief changedArea - returns the bounding rectangle of the pixels that
+ *                      differ between the two tiles within an area of the
+ *                      tile, or an empty rectangle if they are the same
+ *
+ */
+static QRect changedArea(const QImage &tile1, const QImage &tile2,
+                         const QRect &within)
+{
+    // two placeholders only differ if their colors do
+    QRgb color1, color2;
+    if(Canvas::solidColor(tile1, &color1) && Canvas::solidColor(tile2, &color2))
+        return color1 == color2 ? QRect() : within;
+
+    return diffRect(tile1, tile2, within);
+}
+
 /**
  * @brief imagesEqual - returns true if the two images are the same
  *
  */
-bool imagesEqual(const QPixmap &image1, const QPixmap &image2)
+bool imagesEqual(const Canvas &image1, const Canvas &image2)
+{
+    if(image1.size() != image2.size())
+        return false;
+
+    // stop at the first tile that differs
+    for(int i = 0; i < image2.tileCount(); ++i)
+    {
+        if(image2.sharesTile(image1, i))
+            continue;
+
+        QRect local(QPoint(0, 0), image2.tileRect(i).size());
+        if(!changedArea(image1.tile(i), image2.tile(i), local).isEmpty())
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief changedArea - returns the bounding rectangle of the pixels that
+ *                      differ between the two images, an empty rectangle
+ *                      if they are the same, or the whole second image if
+ *                      the sizes don't match
+ *
+ */
+QRect changedArea(const Canvas &image1, const Canvas &image2)
+{
+    return changedArea(image1, image2, image2.rect());
+}
+
+/**
+ * @brief changedArea - same as above, but only looks for differences
+ *                      within the given area
+ *
+ */
+QRect changedArea(const Canvas &image1, const Canvas &image2,
+                  const QRect &within)
 {
-    return image1.toImage() == image2.toImage();
+    if(image1.size() != image2.size())
+        return image2.rect();
+
+    QRect area;
+    QVector<int> tiles = image2.tilesIn(within);
+    for(int i = 0; i < tiles.size(); ++i)
+    {
+        // tiles that weren't drawn on are still shared, so they can't differ
+        if(image2.sharesTile(image1, tiles[i]))
+            continue;
+
+        QRect tileRect = image2.tileRect(tiles[i]);
+        QRect local = within.intersected(tileRect)
+                            .translated(-tileRect.topLeft());
+        area |= changedArea(image1.tile(tiles[i]), image2.tile(tiles[i]), local)
+                    .translated(tileRect.topLeft());
+    }
+    return area;
 }
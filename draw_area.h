@@ -1,13 +1,28 @@
 #ifndef DRAW_AREA_H
 #define DRAW_AREA_H
 
+#include <QElapsedTimer>
+#include <QFutureWatcher>
 #include <QUndoStack>
 
 
+#include "canvas.h"
 #include "constants.h"
+#include "mipmap.h"
 #include "tool.h"
 
 
+class AutoSaver;
+class BmpReader;
+class DrawCommand;
+class ProjectFile;
+class QProgressDialog;
+class QTimer;
+class RenderThread;
+class Resampler;
+class UndoJournal;
+
+
 class DrawArea : public QWidget
 {
     Q_OBJECT
@@ -16,24 +31,48 @@ public:
     DrawArea(QWidget *parent);
     ~DrawArea();
 
-    QPixmap* getImage() { return image; }
+    Canvas* getImage() { return image; }
     Tool* getCurrentTool() const { return currentTool; }
     QColor getForegroundColor() { return foregroundColor; }
     QColor getBackgroundColor() { return backgroundColor; }
+    int getUndoBudget() const { return undoBudget / (1024 * 1024); }
+    qint64 getUndoMemoryUsage() const;
+    const UndoJournal* getUndoJournal() const { return journal; }
+    const AutoSaver* getAutoSaver() const { return autosaver; }
+    const Mipmap& getMipmap() const { return mipmap; }
+    qreal getZoom() const { return zoom; }
+
+    /** input & repaint counters */
+    qint64 getInputEvents() const { return inputEvents; }
+    qint64 getStrokeBatches() const { return strokeBatches; }
+    qint64 getFramesPainted() const { return framesPainted; }
 
     Tool* setCurrentTool(int);
     void setLineMode(const DrawType mode);
+    void setUndoBudget(int megabytes);
 
     /** image edit functions */
     void createNewImage(const QSize&);
     void loadImage(const QString&);
+    QString openMapped(const QString&);
+    QString openProject(const QString&);
+    QString saveProject(const QString&);
+    void restoreImage(const Canvas&);
     void saveImage(const QString&);
-    void resizeImage(const QSize&);
+    void resizeImage(const QSize&, ResizeFilter filter = bicubic_filter);
     void clearImage();
     void updateColorConfig(const QColor&, int);
 
     /** save a command to the undo stack */
-    void saveDrawCommand(const QPixmap&);
+    void saveDrawCommand(const Canvas&, const QRect&);
+
+    /** the image changed within an area: refresh the mipmaps & repaint */
+    void updateImage(const QRect&);
+
+    /** convert between widget and image coordinates */
+    QPoint mapToImage(const QPoint&) const;
+    QRect mapToImage(const QRect&) const;
+    QRect mapFromImage(const QRect&) const;
 
 public slots:
     /** toolbar actions */
@@ -41,6 +80,11 @@ public slots:
     void OnRedo();
     void OnClearAll();
 
+    /** view actions */
+    void OnZoomIn();
+    void OnZoomOut();
+    void OnZoomReset();
+
     /** pen tool */
     void OnPenCapConfig(int);
     void OnPenSizeConfig(int);
@@ -62,29 +106,114 @@ public slots:
     void OnRectLineConfig(int);
     void OnRectCurveConfig(int);
 
+    /** fill tool */
+    void OnFillToleranceConfig(int);
+
+private slots:
+    /** draw the mouse moves collected since the last batch */
+    void OnFlushStroke();
+
+    /** tiles & finished strokes from the render thread */
+    void OnRenderResults();
+
+    /** the worker thread is done writing the image */
+    void OnSaveFinished();
+
+    /** the autosave wants a copy of the image */
+    void OnCheckpointDue();
+
+signals:
+    /** a save finished; error is empty if it worked */
+    void imageSaved(const QString &fileName, const QString &error);
+
 protected:
     /** mouse event handler */
     void virtual mousePressEvent(QMouseEvent *event) override;
     void virtual mouseMoveEvent(QMouseEvent *event) override;
     void virtual mouseReleaseEvent(QMouseEvent *event) override;
     void virtual mouseDoubleClickEvent(QMouseEvent *event) override;
+    void virtual wheelEvent(QWheelEvent *event) override;
 
     /** paint event handler */
     void virtual paintEvent(QPaintEvent *event) override;
 
 private:
     void createTools();
-
-    /** undo stack */
+    void trimUndoHistory();
+    void expireAround(int index);
+    void expireUpTo(int index);
+    DrawCommand* undoCommand(int index) const;
+    void zoomAt(qreal newZoom, const QPointF &anchor);
+    void queueStrokePoint(const QPoint &point);
+    void finishRendering();
+    bool resample(Resampler &resampler);
+    bool readBmp(BmpReader &reader);
+    void setImage(const Canvas &canvas);
+    void closeMapped();
+    void startSave(const Canvas &canvas, const QString &fileName);
+    bool isSaving(const QString &fileName) const;
+    template<class Work> bool runBands(QProgressDialog&, int count, Work);
+
+    /** undo stack, the first command on it that hasn't expired, its memory
+     *  budget in bytes, & the journal for the rest */
     QUndoStack* undoStack;
+    int firstLive;
+    qint64 undoBudget;
+    UndoJournal* journal;
 
     /** reference to current tool & line mode */
     Tool* currentTool;
     DrawType currentLineMode;
 
     /** reference to image */
-    QPixmap* image;
-    QPixmap oldImage;
+    Canvas* image;
+    Canvas oldImage;
+
+    /** painter kept open from press to release, & the thread it records
+     *  the drawing for */
+    CanvasPainter* stroke;
+    RenderThread* renderer;
+
+    /** pen moves waiting to be drawn, at most one batch per frame */
+    QPolygon pendingPoints;
+    QTimer* flushTimer;
+    QElapsedTimer sinceFlush;
+
+    /** the save being written, & where to; and the latest save asked for
+     *  while it is, waiting to be written next */
+    QFutureWatcher<QString>* saveWatcher;
+    QString savingTo;
+    Canvas queuedImage;
+    QString queuedFile;
+
+    /** the file opened for editing in place, if any */
+    BmpReader* mapped;
+
+    /** keeps the recovery journal */
+    AutoSaver* autosaver;
+
+    /** project files opened or saved; commands read from one may still
+     *  need its tiles, so they stay open as long as the history does */
+    QList<ProjectFile*> projects;
+
+    /** counters for the diagnostics dialog */
+    qint64 inputEvents;
+    qint64 strokeBatches;
+    qint64 framesPainted;
+
+    /** line/rect shape being dragged out, shown over the image until release */
+    bool previewing;
+    QPoint previewPoint;
+    QRect previewArea;
+
+    /** viewport: widget = image * zoom + offset */
+    qreal zoom;
+    QPointF offset;
+    bool panning;
+    QPoint panStart;
+
+    /** zoomed out copies of the image */
+    Mipmap mipmap;
 
     /** background/foreground color */
     QColor foregroundColor;
@@ -95,6 +224,7 @@ private:
     LineTool* lineTool;
     EraserTool* eraserTool;
     RectTool* rectTool;
+    FillTool* fillTool;
 
     /** state variables */
     bool drawing;
@@ -106,6 +236,9 @@ private:
 };
 
 /** defined in draw_area.cpp */
-extern bool imagesEqual(const QPixmap& image1, const QPixmap& image2);
+extern bool imagesEqual(const Canvas& image1, const Canvas& image2);
+extern QRect changedArea(const Canvas& image1, const Canvas& image2);
+extern QRect changedArea(const Canvas& image1, const Canvas& image2,
+                         const QRect& within);
 
 #endif // DRAW_AREA_H
@@ -0,0 +1,283 @@
+#include <cstdlib>
+
+#include <QVector>
+
+#include "canvas.h"
+#include "flood_fill.h"
+
+
+namespace {
+
+/**
+ * A span of filled pixels on row y, whose neighbours on row y + dir are
+ * still to be looked at.
+ */
+struct Span
+{
+    int left, right, y, dir;
+};
+
+/**
+ * Scanline fill over the tiles of a canvas. Rows are walked a tile at a
+ * time through the tiles' scanlines; a tile is only detached from copies
+ * of the canvas once something in it is filled.
+ */
+class Filler
+{
+public:
+    Filler(Canvas *canvas, quint32 color, int tolerance);
+    QRect fill(const QPoint &seed);
+
+private:
+    const quint32* pixel(int x, int y) const;
+    bool near(quint32 a, quint32 b) const;
+    bool fillable(quint32 value, int x, int y) const;
+
+    int spanStart(int x, int y) const;
+    int spanEnd(int x, int y) const;
+    int nextFillable(int x, int last, int y) const;
+    void fillSpan(int left, int right, int y);
+
+    Canvas* canvas;
+    int width, height, columns;
+    quint32 color, target;
+    int tolerance;
+
+    /** per tile: its pixels, and whether they were detached for writing */
+    QVector<const uchar*> bits;
+    QVector<int> bytesPerLine;
+    QVector<bool> detached;
+
+    /** filled pixels, one bit each; only needed when the fill color is
+     *  itself near the target, so that filled pixels still match */
+    bool masked;
+    QVector<quint64> mask;
+};
+
+Filler::Filler(Canvas *canvas, quint32 color, int tolerance)
+{
+    this->canvas = canvas;
+    this->color = color;
+    this->tolerance = tolerance;
+    width = canvas->width();
+    height = canvas->height();
+    columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+    target = 0;
+    masked = false;
+
+    const Canvas &tiles = *canvas;
+    for(int i = 0; i < tiles.tileCount(); ++i)
+    {
+        bits.append(tiles.tile(i).constBits());
+        bytesPerLine.append(tiles.tile(i).bytesPerLine());
+    }
+    detached.fill(false, tiles.tileCount());
+}
+
+inline const quint32* Filler::pixel(int x, int y) const
+{
+    int index = (y / TILE_SIZE) * columns + x / TILE_SIZE;
+    return reinterpret_cast<const quint32*>(
+                bits[index] + (y % TILE_SIZE) * bytesPerLine[index]) +
+            x % TILE_SIZE;
+}
+
+/**
+ * @brief Filler::near - Whether two premultiplied pixels differ by no
+ *                       more than the tolerance in any channel
+ *
+ */
+inline bool Filler::near(quint32 a, quint32 b) const
+{
+    if(a == b)
+        return true;
+    if(tolerance == 0)
+        return false;
+    for(int shift = 0; shift < 32; shift += 8)
+    {
+        if(abs(int((a >> shift) & 0xff) - int((b >> shift) & 0xff)) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+inline bool Filler::fillable(quint32 value, int x, int y) const
+{
+    if(!near(value, target))
+        return false;
+    if(!masked)
+        return true;
+    qint64 bit = qint64(y) * width + x;
+    return !(mask[bit >> 6] & (Q_UINT64_C(1) << (bit & 63)));
+}
+
+/**
+ * @brief Filler::spanStart - The left end of the fillable run through x,
+ *                            or x + 1 if x itself can't be filled
+ *
+ */
+int Filler::spanStart(int x, int y) const
+{
+    while(x >= 0)
+    {
+        int tileLeft = x / TILE_SIZE * TILE_SIZE;
+        const quint32 *p = pixel(x, y);
+        for(; x >= tileLeft; --x, --p)
+            if(!fillable(*p, x, y))
+                return x + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Filler::spanEnd - One past the right end of the fillable run
+ *                          starting at x
+ *
+ */
+int Filler::spanEnd(int x, int y) const
+{
+    while(x < width)
+    {
+        int tileRight = qMin(width, (x / TILE_SIZE + 1) * TILE_SIZE);
+        const quint32 *p = pixel(x, y);
+        for(; x < tileRight; ++x, ++p)
+            if(!fillable(*p, x, y))
+                return x;
+    }
+    return width;
+}
+
+/**
+ * @brief Filler::nextFillable - The first fillable pixel from x to last,
+ *                               or last + 1 if there is none
+ *
+ */
+int Filler::nextFillable(int x, int last, int y) const
+{
+    last = qMin(last, width - 1);
+    while(x <= last)
+    {
+        int tileRight = qMin(last + 1, (x / TILE_SIZE + 1) * TILE_SIZE);
+        const quint32 *p = pixel(x, y);
+        for(; x < tileRight; ++x, ++p)
+            if(fillable(*p, x, y))
+                return x;
+    }
+    return last + 1;
+}
+
+/**
+ * @brief Filler::fillSpan - Sets a run of pixels on a row to the color
+ *
+ */
+void Filler::fillSpan(int left, int right, int y)
+{
+    for(int x = left; x <= right; )
+    {
+        int index = (y / TILE_SIZE) * columns + x / TILE_SIZE;
+        if(!detached[index])
+        {
+            // bits() detaches the tile from any copies of the canvas
+            QImage &tile = canvas->tile(index);
+            bits[index] = tile.bits();
+            bytesPerLine[index] = tile.bytesPerLine();
+            detached[index] = true;
+        }
+
+        int tileRight = qMin(right + 1, (x / TILE_SIZE + 1) * TILE_SIZE);
+        quint32 *p = const_cast<quint32*>(pixel(x, y));
+        for(int i = x; i < tileRight; ++i)
+            *p++ = color;
+
+        if(masked)
+        {
+            for(qint64 bit = qint64(y) * width + x; x < tileRight; ++x, ++bit)
+                mask[bit >> 6] |= Q_UINT64_C(1) << (bit & 63);
+        }
+        x = tileRight;
+    }
+}
+
+/**
+ * @brief Filler::fill - Span filling: each filled run is extended as far
+ *                       as it goes both ways, and the rows above and below
+ *                       it are searched for more runs. Runs still to be
+ *                       searched are kept on an explicit stack.
+ *
+ */
+QRect Filler::fill(const QPoint &seed)
+{
+    target = *pixel(seed.x(), seed.y());
+    if(near(color, target))
+    {
+        // filling with the color that is already there changes nothing
+        if(color == target && tolerance == 0)
+            return QRect();
+        masked = true;
+        mask.fill(0, int((qint64(width) * height + 63) / 64));
+    }
+
+    int left = spanStart(seed.x(), seed.y());
+    int right = spanEnd(seed.x(), seed.y()) - 1;
+    fillSpan(left, right, seed.y());
+    QRect area(left, seed.y(), right - left + 1, 1);
+
+    QVector<Span> stack;
+    Span down = { left, right, seed.y(), 1 };
+    Span up = { left, right, seed.y(), -1 };
+    stack.append(down);
+    stack.append(up);
+
+    while(!stack.isEmpty())
+    {
+        Span span = stack.takeLast();
+        int y = span.y + span.dir;
+        if(y < 0 || y >= height)
+            continue;
+
+        int x = nextFillable(span.left, span.right, y);
+        while(x <= span.right)
+        {
+            // runs are filled as far as they go, so only the first can
+            // start left of the span, and any may end right of it
+            int start = x == span.left ? spanStart(x, y) : x;
+            int end = spanEnd(x, y) - 1;
+            fillSpan(start, end, y);
+            area |= QRect(start, y, end - start + 1, 1);
+
+            Span next = { start, end, y, span.dir };
+            stack.append(next);
+
+            // the run may reach around the ends of the span, back
+            // towards the row the span is on
+            if(start < span.left - 1)
+            {
+                Span back = { start, span.left - 2, y, -span.dir };
+                stack.append(back);
+            }
+            if(end > span.right + 1)
+            {
+                Span back = { span.right + 2, end, y, -span.dir };
+                stack.append(back);
+            }
+            x = nextFillable(end + 2, span.right, y);
+        }
+    }
+    return area;
+}
+
+} // namespace
+
+/**
+ * @brief floodFill - Bucket fill, see Filler
+ *
+ */
+QRect floodFill(Canvas *canvas, const QPoint &seed, const QColor &color,
+                int tolerance)
+{
+    if(!canvas->rect().contains(seed))
+        return QRect();
+
+    Filler filler(canvas, qPremultiply(color.rgba()), tolerance);
+    return filler.fill(seed);
+}
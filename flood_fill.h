@@ -0,0 +1,19 @@
+#ifndef FLOOD_FILL_H
+#define FLOOD_FILL_H
+
+#include <QColor>
+#include <QPoint>
+#include <QRect>
+
+
+class Canvas;
+
+/**
+ * Fills the area connected to seed whose pixels are within tolerance
+ * (0-255, in every channel) of the seed pixel with color. Returns the
+ * bounding box of the pixels it filled, or an empty rectangle if none.
+ */
+QRect floodFill(Canvas *canvas, const QPoint &seed, const QColor &color,
+                int tolerance);
+
+#endif // FLOOD_FILL_H
@@ -0,0 +1,298 @@
+#include <cstring>
+#include <QtAlgorithms>
+
+#include "image_diff.h"
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define DIFF_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define DIFF_SSE2
+#endif
+
+
+/**
+ * @brief firstDiff - index of the first pixel that differs, or -1
+ *
+ */
+static int firstDiff(const quint32 *a, const quint32 *b, int count)
+{
+    int x = 0;
+#ifdef DIFF_AVX2
+    for(; x + 8 <= count; x += 8)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + x));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + x));
+        quint32 same = _mm256_movemask_epi8(_mm256_cmpeq_epi32(va, vb));
+        if(same != 0xffffffffu)
+            return x + qCountTrailingZeroBits(~same) / 4;
+    }
+#endif
+#ifdef DIFF_SSE2
+    for(; x + 4 <= count; x += 4)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        quint32 same = _mm_movemask_epi8(_mm_cmpeq_epi32(va, vb));
+        if(same != 0xffffu)
+            return x + qCountTrailingZeroBits(~same & 0xffffu) / 4;
+    }
+#endif
+    for(; x < count; ++x)
+        if(a[x] != b[x])
+            return x;
+    return -1;
+}
+
+/**
+ * @brief lastDiff - index of the last pixel that differs, or -1
+ *
+ */
+static int lastDiff(const quint32 *a, const quint32 *b, int count)
+{
+    int x = count;
+#ifdef DIFF_AVX2
+    for(; x >= 8; x -= 8)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + x - 8));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + x - 8));
+        quint32 same = _mm256_movemask_epi8(_mm256_cmpeq_epi32(va, vb));
+        if(same != 0xffffffffu)
+            return x - 8 + (31 - qCountLeadingZeroBits(~same)) / 4;
+    }
+#endif
+#ifdef DIFF_SSE2
+    for(; x >= 4; x -= 4)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x - 4));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x - 4));
+        quint32 same = _mm_movemask_epi8(_mm_cmpeq_epi32(va, vb));
+        if(same != 0xffffu)
+            return x - 4 + (31 - qCountLeadingZeroBits(~same & 0xffffu)) / 4;
+    }
+#endif
+    while(x > 0)
+    {
+        --x;
+        if(a[x] != b[x])
+            return x;
+    }
+    return -1;
+}
+
+/**
+ * @brief diffRect - Scans two blocks of pixels row by row. Each row is
+ *                   searched from the left for its first difference and
+ *                   from the right for its last, so a row that matches
+ *                   costs one pass of vector compares.
+ *
+ */
+QRect diffRect(const uchar *bits1, int bytesPerLine1,
+               const uchar *bits2, int bytesPerLine2,
+               int width, int height)
+{
+    int left = width, right = -1, top = -1, bottom = -1;
+    for(int y = 0; y < height; ++y)
+    {
+        const quint32 *a = reinterpret_cast<const quint32*>(bits1 + y * bytesPerLine1);
+        const quint32 *b = reinterpret_cast<const quint32*>(bits2 + y * bytesPerLine2);
+
+        int first = firstDiff(a, b, width);
+        if(first < 0)
+            continue;
+
+        if(top < 0)
+            top = y;
+        bottom = y;
+        left = qMin(left, first);
+
+        // only the part right of what we already know can widen the box
+        int from = qMax(first, right + 1);
+        int last = lastDiff(a + from, b + from, width - from);
+        if(last >= 0)
+            right = from + last;
+        else
+            right = qMax(right, first);
+    }
+
+    if(top < 0)
+        return QRect();
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+/**
+ * @brief diffRect - Compares an area of two images of the same size. The
+ *                   images are converted first if their formats differ or
+ *                   aren't 32-bit.
+ *
+ */
+QRect diffRect(const QImage &image1, const QImage &image2, const QRect &area)
+{
+    QImage a = image1, b = image2;
+    if(a.depth() != 32 || a.format() != b.format())
+    {
+        a = a.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        b = b.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+
+    QRect r = area.intersected(a.rect()).intersected(b.rect());
+    if(r.isEmpty())
+        return QRect();
+
+    const int offset = r.x() * 4;
+    QRect diff = diffRect(a.constScanLine(r.y()) + offset, a.bytesPerLine(),
+                          b.constScanLine(r.y()) + offset, b.bytesPerLine(),
+                          r.width(), r.height());
+    return diff.isNull() ? diff : diff.translated(r.topLeft());
+}
+
+/**
+ * The hash keeps eight 64-bit lanes and eats the pixels in 64-byte
+ * stripes. Each lane multiplies the low and high halves of its input
+ * mixed with a key, and the raw input is added to the neighbouring lane;
+ * SSE2 and AVX2 only have 32x32->64 multiplies, which is exactly what
+ * that needs. The key is offset by the stripe's number in the image, so
+ * the same pixels somewhere else add something else, and the lanes are
+ * scrambled at the end of every row, so rows can't trade places. Leftover
+ * pixels at the end of a row go through scalar rounds, so all variants
+ * agree.
+ *
+ */
+static const quint64 PRIME1 = 0x9E3779B185EBCA87ULL;
+static const quint64 PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const quint64 PRIME3 = 0x165667B19E3779F9ULL;
+static const quint64 PRIME32 = 0x9E3779B1ULL;
+static const quint64 HASH_KEY[8] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+    0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL,
+    0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL
+};
+
+static inline quint64 rotl64(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 avalanche(quint64 h)
+{
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * @brief accumulate - Mix one 64-byte stripe into the lanes, with the key
+ *                     offset by the stripe's number
+ *
+ */
+static inline void accumulate(quint64 *acc, const uchar *stripe, quint64 stripeIndex)
+{
+    const quint64 offset = stripeIndex * PRIME3;
+#if defined(DIFF_AVX2)
+    const __m256i shift = _mm256_set1_epi64x(qint64(offset));
+    for(int i = 0; i < 8; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe + i * 8));
+        __m256i key = _mm256_add_epi64(_mm256_loadu_si256(
+                          reinterpret_cast<const __m256i*>(HASH_KEY + i)), shift);
+        __m256i mixed = _mm256_xor_si256(data, key);
+        __m256i product = _mm256_mul_epu32(mixed, _mm256_srli_epi64(mixed, 32));
+        __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        a = _mm256_add_epi64(a, _mm256_add_epi64(product, swapped));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), a);
+    }
+#elif defined(DIFF_SSE2)
+    const __m128i shift = _mm_set1_epi64x(qint64(offset));
+    for(int i = 0; i < 8; i += 2)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stripe + i * 8));
+        __m128i key = _mm_add_epi64(_mm_loadu_si128(
+                          reinterpret_cast<const __m128i*>(HASH_KEY + i)), shift);
+        __m128i mixed = _mm_xor_si128(data, key);
+        __m128i product = _mm_mul_epu32(mixed, _mm_srli_epi64(mixed, 32));
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        a = _mm_add_epi64(a, _mm_add_epi64(product, swapped));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), a);
+    }
+#else
+    quint64 data[8];
+    memcpy(data, stripe, sizeof(data));
+    for(int i = 0; i < 8; ++i)
+    {
+        quint64 mixed = data[i] ^ (HASH_KEY[i] + offset);
+        acc[i] += (mixed & 0xffffffffULL) * (mixed >> 32) + data[i ^ 1];
+    }
+#endif
+}
+
+/**
+ * @brief scramble - Stir each lane on its own, so what was added before
+ *                   can't be told apart from what is added after
+ *
+ */
+static inline void scramble(quint64 *acc)
+{
+    for(int i = 0; i < 8; ++i)
+        acc[i] = (acc[i] ^ (acc[i] >> 47) ^ HASH_KEY[7 - i]) * PRIME32;
+}
+
+/**
+ * @brief contentHash - Hashes the visible pixels of each row, skipping any
+ *                      padding at the end of the rows
+ *
+ */
+quint64 contentHash(const uchar *bits, int bytesPerLine, int width, int height)
+{
+    quint64 acc[8] = { PRIME1, PRIME2, PRIME3, PRIME1 ^ PRIME2,
+                       PRIME2 ^ PRIME3, PRIME3 ^ PRIME1, ~PRIME1, ~PRIME2 };
+
+    const int rowBytes = width * 4;
+    quint64 stripe = 0;
+    for(int y = 0; y < height; ++y)
+    {
+        const uchar *row = bits + y * bytesPerLine;
+        int x = 0;
+        for(; x + 64 <= rowBytes; x += 64)
+            accumulate(acc, row + x, stripe++);
+
+        for(int lane = 0; x < rowBytes; x += 4, ++lane)
+        {
+            quint32 pixel;
+            memcpy(&pixel, row + x, 4);
+            acc[lane & 7] = rotl64(acc[lane & 7] + pixel * PRIME2, 31) * PRIME1;
+        }
+        scramble(acc);
+    }
+
+    quint64 h = quint64(width) * PRIME1 + quint64(height) * PRIME3;
+    for(int i = 0; i < 8; ++i)
+        h = rotl64(h ^ avalanche(acc[i]), 27) * PRIME1 + PRIME2;
+    return avalanche(h);
+}
+
+quint64 contentHash(const QImage &image)
+{
+    QImage pixels = image.depth() == 32 ? image
+                  : image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    return contentHash(pixels.constBits(), pixels.bytesPerLine(),
+                       pixels.width(), pixels.height());
+}
+
+const char* diffKernelName()
+{
+#if defined(DIFF_AVX2)
+    return "AVX2";
+#elif defined(DIFF_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
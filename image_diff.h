@@ -0,0 +1,27 @@
+#ifndef IMAGE_DIFF_H
+#define IMAGE_DIFF_H
+
+#include <QImage>
+#include <QRect>
+
+
+/**
+ * Comparison and hashing kernels for 32-bit pixels (ARGB32, RGB32 or
+ * ARGB32_Premultiplied). They use AVX2 or SSE2 when the build targets
+ * them and plain C++ otherwise; every variant gives the same results.
+ */
+
+/** bounding box of the pixels that differ, or an empty rect if none do */
+QRect diffRect(const uchar *bits1, int bytesPerLine1,
+               const uchar *bits2, int bytesPerLine2,
+               int width, int height);
+QRect diffRect(const QImage &image1, const QImage &image2, const QRect &area);
+
+/** 64-bit hash of the pixels, independent of padding between rows */
+quint64 contentHash(const uchar *bits, int bytesPerLine, int width, int height);
+quint64 contentHash(const QImage &image);
+
+/** the kernels this build was compiled with, for diagnostics */
+const char* diffKernelName();
+
+#endif // IMAGE_DIFF_H
@@ -1,11 +1,44 @@
 #include <qapplication.h>
+#include <QDir>
+#include <QMessageBox>
+
+#include "autosave.h"
 #include "main_window.h"
 
 
 int main(int argc, char* argv[])
 {
     QApplication a(argc, argv);
-    QWidget* w = new MainWindow(0, "Paint");
+
+    // recovery journals are only left behind by sessions that crashed; the
+    // newest is offered, any others on the next starts
+    Canvas recovered;
+    QStringList journals = AutoSaver::orphanedJournals();
+    if(!journals.isEmpty())
+    {
+        QString journal = journals.first();
+        if(QMessageBox::question(0, QObject::tr("Paint"),
+                                 QObject::tr("Paint didn't close normally last time. "
+                                             "Restore the image it was working on?"),
+                                 QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes)
+        {
+            QString error;
+            recovered = AutoSaver::recover(journal, &error);
+            if(recovered.isNull())
+                QMessageBox::warning(0, QObject::tr("Paint"),
+                                     QObject::tr("The image couldn't be restored: %1\n"
+                                                 "The recovery journal is kept at %2.")
+                                     .arg(error, QDir::toNativeSeparators(journal)));
+            else
+                AutoSaver::discard(journal);
+        }
+        else
+            AutoSaver::discard(journal);
+    }
+
+    MainWindow* w = new MainWindow(0, "Paint");
+    if(!recovered.isNull())
+        w->restoreImage(recovered);
     w->show();
     int exitCode = a.exec();
     delete w;
@@ -5,13 +5,19 @@ using namespace std;
 #include <QMouseEvent>
 #include <QFileDialog>
 #include <QColorDialog>
+#include <QInputDialog>
 #include <QSignalMapper>
 #include <QMenuBar>
 #include <QMenu>
+#include <QMessageBox>
+#include <QStatusBar>
 
 #include "main_window.h"
+#include "autosave.h"
 #include "commands.h"
 #include "draw_area.h"
+#include "image_diff.h"
+#include "undo_journal.h"
 
 
 /**
@@ -31,11 +37,16 @@ MainWindow::MainWindow(QWidget* parent, const char* name)
     // create the menu and toolbar
     createMenuAndToolBar();
 
+    // saves finish in the background
+    connect(drawArea, SIGNAL(imageSaved(QString,QString)),
+            this, SLOT(OnImageSaved(QString,QString)));
+
     // init dialog pointers to 0
     penDialog = 0;
     lineDialog = 0;
     eraserDialog = 0;
     rectDialog = 0;
+    fillDialog = 0;
 
     // adjust window size, name, & stop context menu
     setWindowTitle(name);
@@ -96,6 +107,67 @@ void MainWindow::OnLoadImage()
 	}
 }
 
+/**
+ * @brief MainWindow::OnOpenMapped - Open a BMP to be edited in place:
+ *                                   saving it back only writes the parts
+ *                                   that changed
+ */
+void MainWindow::OnOpenMapped()
+{
+    QString s = QFileDialog::getOpenFileName(this, tr("Open File In Place"),
+                                             ".", tr("BMP image (*.bmp)"));
+    if(s.isNull())
+        return;
+
+    QString error = drawArea->openMapped(s);
+    if(!error.isEmpty())
+        QMessageBox::warning(this, tr("Open In Place"),
+                             tr("Could not open %1 in place:\n%2")
+                             .arg(s, error));
+}
+
+/**
+ * @brief MainWindow::OnOpenProject - Open a project file, with the undo
+ *                                    history saved in it
+ */
+void MainWindow::OnOpenProject()
+{
+    QString s = QFileDialog::getOpenFileName(this, tr("Open Project"), ".",
+                                             tr("Paint project (*.paint)"));
+    if(s.isNull())
+        return;
+
+    QString error = drawArea->openProject(s);
+    if(!error.isEmpty())
+        QMessageBox::warning(this, tr("Open Project"),
+                             tr("Could not open %1:\n%2").arg(s, error));
+}
+
+/**
+ * @brief MainWindow::OnSaveProject - Save the image and its undo history
+ *                                    as a project file
+ */
+void MainWindow::OnSaveProject()
+{
+    if(drawArea->getImage()->isNull())
+        return;
+
+    QFileDialog *fileDialog = new QFileDialog(this);
+    fileDialog->setAcceptMode(QFileDialog::AcceptSave);
+    fileDialog->setDirectory(".");
+    fileDialog->setNameFilter(tr("Paint project (*.paint)"));
+    fileDialog->setDefaultSuffix("paint");
+    fileDialog->exec();
+
+    if (fileDialog->result())
+    {
+        QString s = fileDialog->selectedFiles().first();
+        QString error = drawArea->saveProject(s);
+        OnImageSaved(s, error);
+    }
+    delete fileDialog;
+}
+
 /**
  * @brief MainWindow::OnSaveImage - Open a QFileDialogue prompting user to
  *                                  enter a filename and save location.
@@ -127,30 +199,119 @@ void MainWindow::OnSaveImage()
     delete fileDialog;
 }
 
+/**
+ * @brief MainWindow::restoreImage - Show the image recovered after a crash
+ *
+ */
+void MainWindow::restoreImage(const Canvas &canvas)
+{
+    drawArea->restoreImage(canvas);
+    statusBar()->showMessage(tr("Restored the image from the last session"),
+                             5000);
+}
+
+/**
+ * @brief MainWindow::OnImageSaved - Tell the user how a save went
+ *
+ */
+void MainWindow::OnImageSaved(const QString &fileName, const QString &error)
+{
+    if(!error.isEmpty())
+        QMessageBox::warning(this, tr("Save Image"),
+                             tr("Could not save %1:\n%2").arg(fileName, error));
+    else
+        statusBar()->showMessage(tr("Saved %1").arg(fileName), 5000);
+}
+
 /**
  * @brief MainWindow::OnResizeImage - Change the dimensions of the image.
  *
  */
 void MainWindow::OnResizeImage()
 {
-    QPixmap *image = drawArea->getImage();
+    Canvas *image = drawArea->getImage();
     if(image->isNull())
         return;
 
     CanvasSizeDialog* newCanvas = new CanvasSizeDialog(this, "Resize Image",
                                                        image->width(),
-                                                       image->height());
+                                                       image->height(), true);
     newCanvas->exec();
     // if user hit 'OK' button, create new image
     if (newCanvas->result())
     {
          drawArea->resizeImage(QSize(newCanvas->getWidthValue(),
-                                     newCanvas->getHeightValue()));
+                                     newCanvas->getHeightValue()),
+                               newCanvas->getFilter());
     }
     // done with the dialog, free it
     delete newCanvas;
 }
 
+/**
+ * @brief MainWindow::OnUndoBudget - Ask the user how much memory the undo
+ *                                   history may use.
+ *
+ */
+void MainWindow::OnUndoBudget()
+{
+    bool ok;
+    int budget = QInputDialog::getInt(this, tr("Undo Memory"),
+                                      tr("Undo history limit (MB):"),
+                                      drawArea->getUndoBudget(),
+                                      MIN_UNDO_BUDGET, MAX_UNDO_BUDGET,
+                                      16, &ok);
+    // if user hit 'OK' button, change the budget
+    if (ok)
+        drawArea->setUndoBudget(budget);
+}
+
+/**
+ * @brief MainWindow::OnDiagnostics - Show how much memory and disk the undo
+ *                                    history is using.
+ *
+ */
+void MainWindow::OnDiagnostics()
+{
+    const double MB = 1024 * 1024;
+    const UndoJournal *journal = drawArea->getUndoJournal();
+    const AutoSaver *autosaver = drawArea->getAutoSaver();
+
+    QString text = tr("Undo history in memory: %1 MB\n"
+                      "Undo journal on disk: %2 MB (%3 MB in use)\n"
+                      "Journal page-in: %4 us last, %5 us average\n"
+                      "Image compare kernels: %6\n"
+                      "Zoom: %7%, mipmap levels: %8 (%9 MB)\n"
+                      "Mouse moves: %10, stroke batches: %11, frames painted: %12\n"
+                      "Autosave: %13 checkpoints, last %14 ms, %15 KB; journal %16 MB\n"
+                      "Autosave load: %17% of the time (budget %18%), "
+                      "%19 KB/s (budget %20 KB/s)")
+            .arg(drawArea->getUndoMemoryUsage() / MB, 0, 'f', 1)
+            .arg(journal->fileSize() / MB, 0, 'f', 1)
+            .arg(journal->liveBytes() / MB, 0, 'f', 1)
+            .arg(journal->lastPageInTime())
+            .arg(journal->averagePageInTime())
+            .arg(diffKernelName())
+            .arg(qRound(drawArea->getZoom() * 100))
+            .arg(drawArea->getMipmap().levelCount())
+            .arg(drawArea->getMipmap().byteSize() / MB, 0, 'f', 1)
+            .arg(drawArea->getInputEvents())
+            .arg(drawArea->getStrokeBatches())
+            .arg(drawArea->getFramesPainted())
+            .arg(autosaver->checkpointCount())
+            .arg(autosaver->lastCheckpointTime())
+            .arg(autosaver->lastCheckpointBytes() / 1024)
+            .arg(autosaver->journalSize() / MB, 0, 'f', 1)
+            .arg(autosaver->cpuUsage(), 0, 'f', 2)
+            .arg(AUTOSAVE_CPU_BUDGET)
+            .arg(autosaver->ioUsage(), 0, 'f', 1)
+            .arg(AUTOSAVE_IO_BUDGET);
+    if(!autosaver->lastError().isEmpty())
+        text += tr("\nAutosave failed: %1").arg(autosaver->lastError());
+
+    QMessageBox::information(this, tr("Diagnostics"), text);
+}
+
 /**
  * @brief MainWindow::OnPickColor - Open a QColorDialog prompting the user to
  *                                  select a color.
@@ -249,6 +410,22 @@ void MainWindow::OnRectangleDialog()
     rectDialog->show();
 }
 
+/**
+ * @brief MainWindow::OnFillDialog - Open a FillDialog prompting the user
+ *                                   to change fill tool settings.
+ *
+ */
+void MainWindow::OnFillDialog()
+{
+    if (!fillDialog)
+        fillDialog = new FillDialog(this, drawArea);
+
+    if(fillDialog->isVisible())
+        return;
+
+    fillDialog->show();
+}
+
 /**
  * @brief MainWindow::openToolDialog - call the appropriate dialog function
  *                                     based on the current tool.
@@ -262,6 +439,7 @@ void MainWindow::openToolDialog()
         case line: OnLineDialog();           break;
         case eraser: OnEraserDialog();       break;
         case rect_tool: OnRectangleDialog(); break;
+        case fill_tool: OnFillDialog();      break;
     }
 }
 
@@ -303,6 +481,7 @@ void MainWindow::createMenuActions()
     QIcon lineIcon(":/icons/lineIcon");
     QIcon eraserIcon(":/icons/eraserIcon");
     QIcon rectIcon(":/icons/rectIcon");
+    QIcon fillIcon(":/icons/fillIcon");
 
     // File
     QMenu* file = new QMenu(tr("File"), this);
@@ -310,6 +489,11 @@ void MainWindow::createMenuActions()
                                 this, SLOT(OnNewImage()), tr("Ctrl+N"));
     QAction* openAction = file->addAction(openIcon, tr("Load image..."),
                                  this, SLOT(OnLoadImage()), tr("Ctrl+O"));
+    file->addAction(tr("Open in place..."), this, SLOT(OnOpenMapped()),
+                    tr("Ctrl+Shift+O"));
+    file->addAction(tr("Open project..."), this, SLOT(OnOpenProject()));
+    file->addAction(tr("Save project..."), this, SLOT(OnSaveProject()),
+                    tr("Ctrl+Shift+S"));
     QAction* saveAction = file->addAction(saveIcon, tr("Save image..."),
                                  this, SLOT(OnSaveImage()), tr("Ctrl+S"));
     file->addAction("Quit", this, SLOT(close()), tr("Ctrl+Q"));
@@ -324,6 +508,7 @@ void MainWindow::createMenuActions()
                                   drawArea, SLOT(OnClearAll()), tr("Ctrl+C"));
     QAction* resizeAction = edit->addAction(resizeIcon, tr("Resize Image..."),
                                    this, SLOT(OnResizeImage()), tr("Ctrl+R"));
+    edit->addAction(tr("Undo Memory..."), this, SLOT(OnUndoBudget()));
 
     // color pickers (still under >Edit)
     QSignalMapper *signalMapper = new QSignalMapper(this);
@@ -371,10 +556,16 @@ void MainWindow::createMenuActions()
             signalMapperT, SLOT(map()));
     rectAction->setShortcut(tr("R"));
 
+    QAction* fillAction = new QAction(fillIcon, tr("Fill Tool"), this);
+    connect(fillAction, SIGNAL(triggered()),
+            signalMapperT, SLOT(map()));
+    fillAction->setShortcut(tr("B"));
+
     signalMapperT->setMapping(penAction, pen);
     signalMapperT->setMapping(lineAction, line);
     signalMapperT->setMapping(eraserAction, eraser);
     signalMapperT->setMapping(rectAction, rect_tool);
+    signalMapperT->setMapping(fillAction, fill_tool);
 
     connect(signalMapperT, SIGNAL(mapped(int)), this, SLOT(OnChangeTool(int)));
 
@@ -384,6 +575,7 @@ void MainWindow::createMenuActions()
     tools->addAction(lineAction);
     tools->addAction(eraserAction);
     tools->addAction(rectAction);
+    tools->addAction(fillAction);
     tools->addAction(tr("Pen Properties..."),
                      this, SLOT(OnPenDialog()));
     tools->addAction(tr("Line Properties..."),
@@ -392,6 +584,8 @@ void MainWindow::createMenuActions()
                      this, SLOT(OnEraserDialog()));
     tools->addAction(tr("Rectangle Properties..."),
                      this, SLOT(OnRectangleDialog()));
+    tools->addAction(tr("Fill Properties..."),
+                     this, SLOT(OnFillDialog()));
 
     // store the actions in QLists for convenience
     imageActions.append(newAction);
@@ -408,6 +602,7 @@ void MainWindow::createMenuActions()
     toolActions.append(lineAction);
     toolActions.append(eraserAction);
     toolActions.append(rectAction);
+    toolActions.append(fillAction);
 
     // populate the menubar with menu items
     menuBar()->addMenu(file);
@@ -430,5 +625,14 @@ void MainWindow::createToolBarToggle()
     toggleToolbar->setShortcut(tr("Ctrl+T"));
 
     view->addAction(toggleToolbar);
+    view->addSeparator();
+    view->addAction(tr("Zoom &In"), drawArea, SLOT(OnZoomIn()),
+                    QKeySequence::ZoomIn);
+    view->addAction(tr("Zoom &Out"), drawArea, SLOT(OnZoomOut()),
+                    QKeySequence::ZoomOut);
+    view->addAction(tr("&Actual Size"), drawArea, SLOT(OnZoomReset()),
+                    tr("Ctrl+0"));
+    view->addSeparator();
+    view->addAction(tr("Diagnostics..."), this, SLOT(OnDiagnostics()));
     menuBar()->addMenu(view);
 }
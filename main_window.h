@@ -21,6 +21,9 @@ public:
     MainWindow(QWidget* parent = 0, const char* name = 0);
     ~MainWindow();
 
+    /** put back an image recovered after a crash */
+    void restoreImage(const Canvas&);
+
     /** mouse event handler */
     void virtual mousePressEvent (QMouseEvent*) override;
 
@@ -28,15 +31,22 @@ public slots:
     /** toolbar actions */
     void OnNewImage();
 	void OnLoadImage();
+    void OnOpenMapped();
+    void OnOpenProject();
+    void OnSaveProject();
     void OnSaveImage();
     void OnResizeImage();
+    void OnUndoBudget();
+    void OnDiagnostics();
     void OnPickColor(int);
     void OnChangeTool(int);
+    void OnImageSaved(const QString&, const QString&);
     /** tool dialogs */
     void OnPenDialog();
     void OnLineDialog();
     void OnEraserDialog();
     void OnRectangleDialog();
+    void OnFillDialog();
 
 private:
     void createMenuActions();
@@ -64,6 +74,7 @@ private:
     LineDialog* lineDialog;
     EraserDialog* eraserDialog;
     RectDialog* rectDialog;
+    FillDialog* fillDialog;
 
     /** Don't allow copying */
     MainWindow(const MainWindow&);
@@ -0,0 +1,177 @@
+#include <cmath>
+
+#include <QtMath>
+
+#include "canvas.h"
+#include "mipmap.h"
+
+
+/**
+ * @brief halve - Shrinks an area of src into dst by averaging each 2x2
+ *                block. Averaging premultiplied pixels channel by channel
+ *                is correct, and two channels are summed at once since
+ *                four bytes never overflow 16 bits. srcOrigin is where
+ *                src sits, in the pixels of the level above dst.
+ *
+ */
+static void halve(const QImage &src, const QPoint &srcOrigin,
+                  QImage &dst, const QRect &dstArea)
+{
+    const int lastX = src.width() - 1, lastY = src.height() - 1;
+    for(int y = dstArea.top(); y <= dstArea.bottom(); ++y)
+    {
+        int sy = 2 * y - srcOrigin.y();
+        const quint32 *row0 = reinterpret_cast<const quint32*>(src.constScanLine(sy));
+        const quint32 *row1 = reinterpret_cast<const quint32*>(src.constScanLine(qMin(sy + 1, lastY)));
+        quint32 *out = reinterpret_cast<quint32*>(dst.scanLine(y));
+
+        for(int x = dstArea.left(); x <= dstArea.right(); ++x)
+        {
+            int sx = 2 * x - srcOrigin.x();
+            int sx1 = qMin(sx + 1, lastX);
+            quint32 p0 = row0[sx], p1 = row0[sx1], p2 = row1[sx], p3 = row1[sx1];
+
+            quint32 rb = (p0 & 0xff00ff) + (p1 & 0xff00ff)
+                       + (p2 & 0xff00ff) + (p3 & 0xff00ff) + 0x20002;
+            quint32 ag = ((p0 >> 8) & 0xff00ff) + ((p1 >> 8) & 0xff00ff)
+                       + ((p2 >> 8) & 0xff00ff) + ((p3 >> 8) & 0xff00ff) + 0x20002;
+            out[x] = ((rb >> 2) & 0xff00ff) | (((ag >> 2) & 0xff00ff) << 8);
+        }
+    }
+}
+
+/**
+ * @brief levelArea - The pixels of a level that cover an area of the canvas
+ *
+ */
+static QRect levelArea(const QRect &area, int index)
+{
+    return QRect(QPoint(area.left() >> index, area.top() >> index),
+                 QPoint(area.right() >> index, area.bottom() >> index));
+}
+
+/**
+ * @brief Mipmap::byteSize - Memory held by the levels built so far
+ *
+ */
+qint64 Mipmap::byteSize() const
+{
+    qint64 total = 0;
+    for(int i = 0; i < levels.size(); ++i)
+        total += qint64(levels[i].bytesPerLine()) * levels[i].height();
+    return total;
+}
+
+/**
+ * @brief Mipmap::reset - Drop every level, they'll be rebuilt for the new
+ *                        size as they are needed
+ *
+ */
+void Mipmap::reset(const QSize &size)
+{
+    imageSize = size;
+    levels.clear();
+    dirty.clear();
+}
+
+/**
+ * @brief Mipmap::invalidate - Mark an area of every level as stale. Nothing
+ *                             is redrawn until that area is needed.
+ *
+ */
+void Mipmap::invalidate(const QRect &area)
+{
+    QRect r = area.intersected(QRect(QPoint(0, 0), imageSize));
+    if(r.isEmpty())
+        return;
+    for(int i = 0; i < dirty.size(); ++i)
+        dirty[i] += r;
+}
+
+/**
+ * @brief Mipmap::levelFor - The smallest level that still has at least
+ *                           one of its pixels per screen pixel
+ *
+ */
+int Mipmap::levelFor(qreal zoom)
+{
+    if(zoom >= 1)
+        return 0;
+    return qFloor(std::log2(1 / zoom) + 1e-9);
+}
+
+/**
+ * @brief Mipmap::level - Returns a level, regenerating whatever part of it
+ *                        in the area is stale first. Level 0 is the canvas
+ *                        itself and isn't kept here.
+ *
+ */
+const QImage& Mipmap::level(int index, const QRect &area, const Canvas &canvas)
+{
+    // levels are created on first use, stale all over
+    for(int i = levels.size() + 1; i <= index; ++i)
+    {
+        int shift = i;
+        QSize size((imageSize.width() + (1 << shift) - 1) >> shift,
+                   (imageSize.height() + (1 << shift) - 1) >> shift);
+        levels.append(QImage(size, QImage::Format_ARGB32_Premultiplied));
+        dirty.append(QRegion(QRect(QPoint(0, 0), imageSize)));
+    }
+
+    rebuild(index, area, canvas);
+    return levels[index - 1];
+}
+
+/**
+ * @brief Mipmap::rebuild - Regenerate the stale part of a level within an
+ *                          area, after making sure the level above it is
+ *                          up to date there
+ *
+ */
+void Mipmap::rebuild(int index, const QRect &area, const Canvas &canvas)
+{
+    // widen the area to whole pixels of this level
+    const int mask = (1 << index) - 1;
+    QRect aligned(QPoint(area.left() & ~mask, area.top() & ~mask),
+                  QPoint(area.right() | mask, area.bottom() | mask));
+    aligned &= QRect(QPoint(0, 0), imageSize);
+
+    QRegion stale = dirty[index - 1].intersected(aligned);
+    if(stale.isEmpty())
+        return;
+
+    // the level above has to be current under every pixel rebuilt here
+    QRect bounds = stale.boundingRect();
+    if(index > 1)
+        rebuild(index - 1, QRect(QPoint(bounds.left() & ~mask, bounds.top() & ~mask),
+                                 QPoint(bounds.right() | mask, bounds.bottom() | mask)),
+                canvas);
+
+    QImage &dst = levels[index - 1];
+    for(const QRect &r : stale)
+    {
+        // stale parts may not cover whole pixels of this level
+        QRect whole(QPoint(r.left() & ~mask, r.top() & ~mask),
+                    QPoint(r.right() | mask, r.bottom() | mask));
+        whole &= QRect(QPoint(0, 0), imageSize);
+
+        if(index == 1)
+        {
+            // the canvas tiles have even sizes except at the edges, so
+            // no 2x2 block is split between tiles
+            QVector<int> tiles = canvas.tilesIn(whole);
+            for(int i = 0; i < tiles.size(); ++i)
+            {
+                QRect tileRect = canvas.tileRect(tiles[i]);
+                halve(canvas.tile(tiles[i]), tileRect.topLeft(), dst,
+                      levelArea(whole.intersected(tileRect), 1));
+            }
+        }
+        else
+        {
+            halve(levels[index - 2], QPoint(0, 0), dst,
+                  levelArea(whole, index));
+        }
+    }
+    dirty[index - 1] -= QRegion(aligned);
+}
@@ -0,0 +1,53 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <QImage>
+#include <QRegion>
+#include <QVector>
+
+
+class Canvas;
+
+/**
+ * Downsampled copies of the canvas, each half the size of the one before,
+ * for drawing it zoomed out. A level is built the first time it is asked
+ * for, and after that only the parts of it that changed are rebuilt.
+ */
+class Mipmap
+{
+public:
+    Mipmap() {}
+
+    QSize size() const { return imageSize; }
+    int levelCount() const { return levels.size(); }
+    qint64 byteSize() const;
+
+    /** start over for a canvas of a new size */
+    void reset(const QSize &size);
+
+    /** an area of the canvas changed */
+    void invalidate(const QRect &area);
+
+    /** the level to draw at a zoom factor, 0 being the canvas itself */
+    static int levelFor(qreal zoom);
+
+    /** a level, brought up to date at least within area (in canvas pixels) */
+    const QImage& level(int index, const QRect &area, const Canvas &canvas);
+
+private:
+    void rebuild(int index, const QRect &area, const Canvas &canvas);
+
+    QSize imageSize;
+
+    /** levels[0] is half the size of the canvas */
+    QVector<QImage> levels;
+
+    /** the stale parts of each level, in canvas pixels */
+    QVector<QRegion> dirty;
+
+    /** Don't allow copying */
+    Mipmap(const Mipmap&);
+    Mipmap& operator=(const Mipmap&);
+};
+
+#endif // MIPMAP_H
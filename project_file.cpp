@@ -0,0 +1,500 @@
+#include <cstring>
+
+#include <QDataStream>
+#include <QObject>
+#include <QSaveFile>
+#include <QtConcurrent>
+#include <QtEndian>
+
+#include "image_diff.h"
+#include "project_file.h"
+
+
+/** file header: magic & format version */
+static const char MAGIC[8] = {'P', 'A', 'I', 'N', 'T', 'P', 'R', 'J'};
+static const quint32 VERSION = 1;
+static const int FILE_HEADER_SIZE = 16;
+
+/** every chunk starts with its type & payload length */
+static const int CHUNK_HEADER_SIZE = 8;
+enum ChunkType { tile_chunk = 1, state_chunk = 2, end_chunk = 3 };
+
+/** a tile chunk's payload: hash, width & height, then the packed pixels */
+static const int TILE_HEADER_SIZE = 12;
+
+QDataStream& operator<<(QDataStream &out, const TileRef &ref)
+{
+    return out << ref.solid << ref.value;
+}
+
+QDataStream& operator>>(QDataStream &in, TileRef &ref)
+{
+    return in >> ref.solid >> ref.value;
+}
+
+/**
+ * @brief tileHash - The content hash of a tile, mixed with its size so
+ *                   edge tiles with the same pixels in another shape don't
+ *                   collide. Where a tile's pixels are counts too, see
+ *                   contentHash().
+ *
+ */
+static quint64 tileHash(const QImage &tile)
+{
+    quint64 size = quint64(tile.width()) << 32 | quint64(tile.height());
+    return contentHash(tile) ^ (size * Q_UINT64_C(0x9e3779b97f4a7c15));
+}
+
+/**
+ * @brief packTile - A tile chunk's payload
+ *
+ */
+static QByteArray packTile(const QImage &tile, quint64 hash)
+{
+    uchar header[TILE_HEADER_SIZE];
+    qToLittleEndian<quint64>(hash, header);
+    qToLittleEndian<quint16>(tile.width(), header + 8);
+    qToLittleEndian<quint16>(tile.height(), header + 10);
+
+    // 32-bit rows are exactly the width apart
+    QByteArray payload(reinterpret_cast<const char*>(header), TILE_HEADER_SIZE);
+    payload.append(qCompress(tile.constBits(), tile.width() * tile.height() * 4,
+                             1));
+    return payload;
+}
+
+/**
+ * @brief ProjectFile::ProjectFile - Nothing is read until open()
+ *
+ */
+ProjectFile::ProjectFile(const QString &fileName)
+    : file(fileName)
+{
+    map = 0;
+    mapSize = 0;
+    fresh = false;
+}
+
+ProjectFile::~ProjectFile()
+{
+    if(map)
+        file.unmap(map);
+}
+
+/**
+ * @brief ProjectFile::open - Maps the file and reads the last state saved.
+ *                            If the last save didn't finish, the file is
+ *                            cut back to the end of the last whole state.
+ *
+ */
+bool ProjectFile::open()
+{
+    if(!file.open(QIODevice::ReadWrite))
+        return fail(file.errorString());
+    if(!remap())
+        return false;
+
+    if(mapSize < FILE_HEADER_SIZE || memcmp(map, MAGIC, sizeof(MAGIC)) != 0)
+        return fail(QObject::tr("The file is not a project."));
+    if(qFromLittleEndian<quint32>(map + 8) > VERSION)
+        return fail(QObject::tr("The project was saved by a newer version."));
+
+    // normally the end chunk says where the last state is
+    qint64 offset = -1;
+    if(mapSize >= FILE_HEADER_SIZE + CHUNK_HEADER_SIZE + 8)
+    {
+        const uchar *end = map + mapSize - CHUNK_HEADER_SIZE - 8;
+        if(qFromLittleEndian<quint32>(end) == end_chunk &&
+           qFromLittleEndian<quint32>(end + 4) == 8)
+            offset = qFromLittleEndian<qint64>(end + CHUNK_HEADER_SIZE);
+    }
+
+    if(offset < 0)
+    {
+        offset = findLastState();
+        if(offset < 0)
+            return fail(QObject::tr("The project has no image saved in it."));
+
+        // drop whatever follows that state, so saves append after it
+        quint32 length = qFromLittleEndian<quint32>(map + offset + 4);
+        file.unmap(map);
+        map = 0;
+        if(!file.resize(offset + CHUNK_HEADER_SIZE + length) || !remap())
+            return fail(file.errorString());
+    }
+    return readState(offset);
+}
+
+/**
+ * @brief ProjectFile::create - Starts an empty project in place of the
+ *                              file. Nothing is written until commit(),
+ *                              which replaces the file only once all of the
+ *                              new project is written.
+ *
+ */
+bool ProjectFile::create()
+{
+    if(map)
+        file.unmap(map);
+    map = 0;
+    mapSize = 0;
+    file.close();
+
+    tiles.clear();
+    hashes.clear();
+    lastState = QByteArray();
+    fresh = true;
+    return true;
+}
+
+/**
+ * @brief ProjectFile::writeHeader - The magic and format version
+ *
+ */
+static bool writeHeader(QIODevice *device)
+{
+    uchar header[FILE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    qToLittleEndian<quint32>(VERSION, header + 8);
+    return device->write(reinterpret_cast<const char*>(header),
+                         FILE_HEADER_SIZE) == FILE_HEADER_SIZE;
+}
+
+/**
+ * @brief ProjectFile::fail - Give up on the file, keeping the reason
+ *
+ */
+bool ProjectFile::fail(const QString &message)
+{
+    error = message;
+    if(map)
+        file.unmap(map);
+    map = 0;
+    mapSize = 0;
+    file.close();
+    return false;
+}
+
+/**
+ * @brief ProjectFile::addTile - Placeholders are kept as their color, any
+ *                               other tile by its hash. Tiles that haven't
+ *                               been drawn on since they were last added
+ *                               aren't hashed again.
+ *
+ */
+TileRef ProjectFile::addTile(const QImage &tile)
+{
+    TileRef ref;
+    QRgb color;
+    ref.solid = Canvas::solidColor(tile, &color);
+    if(ref.solid)
+    {
+        ref.value = color;
+        return ref;
+    }
+
+    QHash<qint64, quint64>::const_iterator it = hashes.constFind(tile.cacheKey());
+    if(it != hashes.constEnd())
+        ref.value = it.value();
+    else
+    {
+        // a hash can be shared by different pixels; a tile whose hash is
+        // taken by another one is kept under the next free value
+        ref.value = tileHash(tile);
+        while(tiles.contains(ref.value) && !sameTile(ref.value, tile))
+            ++ref.value;
+        hashes.insert(tile.cacheKey(), ref.value);
+    }
+
+    if(!tiles.contains(ref.value))
+    {
+        tiles.insert(ref.value, -1 - pending.size());
+        pending.append(tile);
+        pendingHashes.append(ref.value);
+    }
+    return ref;
+}
+
+/**
+ * @brief ProjectFile::sameTile - Whether the tile kept under a key, in the
+ *                                file or queued, has the same pixels
+ *
+ */
+bool ProjectFile::sameTile(quint64 key, const QImage &tile) const
+{
+    qint64 offset = tiles.value(key);
+    if(offset < 0)
+        return pending.at(-1 - offset) == tile;
+
+    QImage stored = unpack(offset, tile.size());
+    return !stored.isNull() && stored == tile;
+}
+
+/**
+ * @brief ProjectFile::writeCanvas - The size of a canvas, then its tiles
+ *
+ */
+void ProjectFile::writeCanvas(QDataStream &out, const Canvas &canvas)
+{
+    out << canvas.size();
+    for(int i = 0; i < canvas.tileCount(); ++i)
+        out << addTile(canvas.tile(i));
+}
+
+/**
+ * @brief ProjectFile::tile - Unpacks a tile from its chunk in the map, or
+ *                            gives a null image if it is missing or
+ *                            damaged
+ *
+ */
+QImage ProjectFile::tile(const TileRef &ref, const QSize &size) const
+{
+    if(ref.solid)
+        return Canvas::solidTile(size, QRgb(ref.value));
+
+    return unpack(tiles.value(ref.value, -1), size);
+}
+
+/**
+ * @brief ProjectFile::unpack - Unpacks the tile chunk at offset, or gives a
+ *                              null image if it's missing, damaged or of
+ *                              another size
+ *
+ */
+QImage ProjectFile::unpack(qint64 offset, const QSize &size) const
+{
+    if(offset < 0 || offset + CHUNK_HEADER_SIZE + TILE_HEADER_SIZE > mapSize)
+        return QImage();
+
+    const uchar *chunk = map + offset;
+    qint64 length = qFromLittleEndian<quint32>(chunk + 4);
+    const uchar *payload = chunk + CHUNK_HEADER_SIZE;
+    if(offset + CHUNK_HEADER_SIZE + length > mapSize ||
+       qFromLittleEndian<quint16>(payload + 8) != size.width() ||
+       qFromLittleEndian<quint16>(payload + 10) != size.height())
+        return QImage();
+
+    QByteArray pixels = qUncompress(payload + TILE_HEADER_SIZE,
+                                    int(length) - TILE_HEADER_SIZE);
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    if(image.isNull() || pixels.size() != size.width() * size.height() * 4)
+        return QImage();
+
+    memcpy(image.bits(), pixels.constData(), pixels.size());
+    return image;
+}
+
+/**
+ * @brief ProjectFile::readCanvas - Reads a canvas written by writeCanvas(),
+ *                                  unpacking its tiles on every core. The
+ *                                  canvas is null if any tile is missing
+ *                                  or damaged.
+ *
+ */
+Canvas ProjectFile::readCanvas(QDataStream &in) const
+{
+    QSize size;
+    in >> size;
+    if(in.status() != QDataStream::Ok || size.isEmpty())
+        return Canvas();
+
+    Canvas canvas(size, Qt::transparent);
+    QVector<TileRef> refs(canvas.tileCount());
+    for(int i = 0; i < refs.size(); ++i)
+        in >> refs[i];
+    if(in.status() != QDataStream::Ok)
+        return Canvas();
+
+    // the canvas isn't shared yet, so each thread only touches its tiles
+    QVector<int> indexes;
+    for(int i = 0; i < refs.size(); ++i)
+        indexes.append(i);
+    QtConcurrent::blockingMap(indexes, [this, &canvas, &refs](int &i) {
+        canvas.tile(i) = tile(refs.at(i), canvas.tileRect(i).size());
+    });
+
+    for(int i = 0; i < canvas.tileCount(); ++i)
+        if(canvas.tile(i).isNull())
+            return Canvas();
+    return canvas;
+}
+
+/**
+ * @brief ProjectFile::commit - Packs the queued tiles on every core and
+ *                              appends them, then the state with where
+ *                              every tile is, then the end chunk that
+ *                              points at it
+ *
+ */
+bool ProjectFile::commit(const QByteArray &state)
+{
+    QVector<QByteArray> packed(pending.size());
+    QVector<int> indexes;
+    for(int i = 0; i < pending.size(); ++i)
+        indexes.append(i);
+    QtConcurrent::blockingMap(indexes, [this, &packed](int &i) {
+        packed[i] = packTile(pending.at(i), pendingHashes.at(i));
+    });
+
+    // a new project goes to a temporary file that only replaces the old
+    // one once it's complete; an open one is appended to
+    QSaveFile replacement(file.fileName());
+    QIODevice *out = &file;
+    bool written;
+    if(fresh)
+    {
+        out = &replacement;
+        written = replacement.open(QIODevice::WriteOnly) &&
+                  writeHeader(&replacement);
+    }
+    else
+        written = file.seek(file.size());
+
+    for(int i = 0; written && i < packed.size(); ++i)
+    {
+        qint64 offset = out->pos();
+        written = append(out, tile_chunk, packed.at(i));
+        if(written)
+            tiles.insert(pendingHashes.at(i), offset);
+    }
+
+    qint64 stateOffset = out->pos();
+    if(written)
+    {
+        QByteArray payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << quint32(tiles.size());
+        for(QHash<quint64, qint64>::const_iterator it = tiles.constBegin();
+            it != tiles.constEnd(); ++it)
+            stream << it.key() << it.value();
+        stream << state;
+        written = append(out, state_chunk, payload);
+    }
+    if(written)
+    {
+        uchar end[8];
+        qToLittleEndian<qint64>(stateOffset, end);
+        written = append(out, end_chunk,
+                         QByteArray(reinterpret_cast<const char*>(end),
+                                    sizeof(end)));
+    }
+    if(written)
+        written = fresh ? replacement.commit() : file.flush();
+
+    // tiles that didn't make it in are added again next time; their keys
+    // may go to other pixels then, so the keys seen are forgotten. Nothing
+    // of a new project that failed was kept.
+    if(!written && fresh)
+        tiles.clear();
+    for(int i = 0; i < pendingHashes.size(); ++i)
+        if(tiles.value(pendingHashes.at(i)) < 0)
+            tiles.remove(pendingHashes.at(i));
+    pending.clear();
+    pendingHashes.clear();
+
+    if(!written)
+    {
+        hashes.clear();
+        error = out->errorString();
+        return false;
+    }
+
+    if(fresh)
+    {
+        fresh = false;
+        if(!file.open(QIODevice::ReadWrite))
+            return fail(file.errorString());
+    }
+    lastState = state;
+    return remap();
+}
+
+/**
+ * @brief ProjectFile::append - Writes a chunk where the device is
+ *
+ */
+bool ProjectFile::append(QIODevice *out, quint32 type, const QByteArray &payload)
+{
+    uchar header[CHUNK_HEADER_SIZE];
+    qToLittleEndian<quint32>(type, header);
+    qToLittleEndian<quint32>(payload.size(), header + 4);
+    return out->write(reinterpret_cast<const char*>(header),
+                      CHUNK_HEADER_SIZE) == CHUNK_HEADER_SIZE &&
+           out->write(payload) == payload.size();
+}
+
+/**
+ * @brief ProjectFile::readState - Reads the tile table and the state of
+ *                                 the state chunk at offset
+ *
+ */
+bool ProjectFile::readState(qint64 offset)
+{
+    if(offset < FILE_HEADER_SIZE || offset + CHUNK_HEADER_SIZE > mapSize ||
+       qFromLittleEndian<quint32>(map + offset) != state_chunk)
+        return fail(QObject::tr("The project file is damaged."));
+
+    qint64 length = qFromLittleEndian<quint32>(map + offset + 4);
+    if(offset + CHUNK_HEADER_SIZE + length > mapSize)
+        return fail(QObject::tr("The project file is damaged."));
+
+    QByteArray payload = QByteArray::fromRawData(
+                reinterpret_cast<const char*>(map + offset + CHUNK_HEADER_SIZE),
+                int(length));
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 count;
+    in >> count;
+    tiles.clear();
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+    {
+        quint64 hash;
+        qint64 tileOffset;
+        in >> hash >> tileOffset;
+        tiles.insert(hash, tileOffset);
+    }
+    in >> lastState;
+
+    if(in.status() != QDataStream::Ok)
+        return fail(QObject::tr("The project file is damaged."));
+    return true;
+}
+
+/**
+ * @brief ProjectFile::findLastState - Walks the chunks from the start for
+ *                                     the last whole state, or -1
+ *
+ */
+qint64 ProjectFile::findLastState() const
+{
+    qint64 last = -1;
+    qint64 pos = FILE_HEADER_SIZE;
+    while(pos + CHUNK_HEADER_SIZE <= mapSize)
+    {
+        qint64 length = qFromLittleEndian<quint32>(map + pos + 4);
+        if(pos + CHUNK_HEADER_SIZE + length > mapSize)
+            break;
+        if(qFromLittleEndian<quint32>(map + pos) == state_chunk)
+            last = pos;
+        pos += CHUNK_HEADER_SIZE + length;
+    }
+    return last;
+}
+
+/**
+ * @brief ProjectFile::remap - Maps the whole file again, after it grew
+ *
+ */
+bool ProjectFile::remap()
+{
+    if(map)
+        file.unmap(map);
+    mapSize = file.size();
+    map = file.map(0, mapSize);
+    if(!map)
+        return fail(file.errorString());
+    return true;
+}
@@ -0,0 +1,105 @@
+#ifndef PROJECT_FILE_H
+#define PROJECT_FILE_H
+
+#include <QFile>
+#include <QHash>
+#include <QVector>
+
+#include "canvas.h"
+
+
+class QDataStream;
+
+/**
+ * A tile as kept in a project file: either the color of a placeholder,
+ * or the key of the pixels stored in the file. The key is their content
+ * hash, or the next value after it not taken by other pixels.
+ */
+struct TileRef
+{
+    bool solid;
+    quint64 value;
+};
+
+QDataStream& operator<<(QDataStream &out, const TileRef &ref);
+QDataStream& operator>>(QDataStream &in, TileRef &ref);
+
+/**
+ * The native project format: an append-only file of chunks. Tile chunks
+ * hold the compressed pixels of one tile, each different tile stored once.
+ * State chunks hold the image and undo history of a save as tile
+ * references, along with where each tile is. The file ends with a chunk
+ * pointing at the last state, so opening reads just that, through a
+ * memory map, and tiles are only decoded when they are needed.
+ *
+ * Saving appends the tiles the file doesn't have yet and a new state;
+ * nothing already written is changed, so a save cut short leaves the one
+ * before it readable. A new project is written to a temporary file that
+ * replaces the old one only when it's complete.
+ */
+class ProjectFile
+{
+public:
+    explicit ProjectFile(const QString &fileName);
+    ~ProjectFile();
+
+    /** open the project, or start a new, empty one in its place; the file
+     *  is only replaced once the first commit() has written all of it */
+    bool open();
+    bool create();
+    QString errorString() const { return error; }
+    QString fileName() const { return file.fileName(); }
+    qint64 fileSize() const { return mapSize; }
+
+    /** the state written by the last save */
+    QByteArray state() const { return lastState; }
+
+    /** a tile as a reference to write to a state; tiles the file doesn't
+     *  have are queued until commit() */
+    TileRef addTile(const QImage &tile);
+    void writeCanvas(QDataStream &out, const Canvas &canvas);
+
+    /** decode a tile from the file, null if it's missing or damaged; any
+     *  thread may read tiles */
+    QImage tile(const TileRef &ref, const QSize &size) const;
+    Canvas readCanvas(QDataStream &in) const;
+
+    /** append the queued tiles, then state as the new last state */
+    bool commit(const QByteArray &state);
+
+private:
+    bool fail(const QString &message);
+    bool append(QIODevice *out, quint32 type, const QByteArray &payload);
+    bool readState(qint64 offset);
+    bool sameTile(quint64 key, const QImage &tile) const;
+    QImage unpack(qint64 offset, const QSize &size) const;
+    qint64 findLastState() const;
+    bool remap();
+
+    QFile file;
+    QString error;
+    uchar* map;
+    qint64 mapSize;
+
+    /** started by create(), and not written yet */
+    bool fresh;
+
+    /** where each tile's chunk is, by key; tiles queued for the next
+     *  commit are at -1 - their place in the queue */
+    QHash<quint64, qint64> tiles;
+
+    /** tiles added since the last commit, & the keys of tiles already
+     *  seen, by QImage::cacheKey(), so unchanged tiles aren't hashed and
+     *  compared again */
+    QVector<QImage> pending;
+    QVector<quint64> pendingHashes;
+    QHash<qint64, quint64> hashes;
+
+    QByteArray lastState;
+
+    /** Don't allow copying */
+    ProjectFile(const ProjectFile&);
+    ProjectFile& operator=(const ProjectFile&);
+};
+
+#endif // PROJECT_FILE_H
@@ -0,0 +1,248 @@
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include "render_thread.h"
+
+
+/** how often tiles are handed over while a long stroke is being drawn */
+static const int PUBLISH_INTERVAL = 8;
+
+/**
+ * @brief RenderThread::RenderThread - Starts the thread, waiting for work
+ *
+ */
+RenderThread::RenderThread(QObject *parent)
+    : QThread(parent)
+{
+    busy = false;
+    quit = false;
+    painter = 0;
+    start();
+}
+
+RenderThread::~RenderThread()
+{
+    mutex.lock();
+    quit = true;
+    workQueued.wakeOne();
+    mutex.unlock();
+    wait();
+    delete painter;
+}
+
+/**
+ * @brief RenderThread::post - Queue a drawing call
+ *
+ */
+void RenderThread::post(const PaintOp &op)
+{
+    QMutexLocker locker(&mutex);
+    queue.enqueue(op);
+    busy = true;
+    workQueued.wakeOne();
+}
+
+/**
+ * @brief RenderThread::reset - Start drawing on a copy of image, after it
+ *                              was changed by something other than a stroke
+ *
+ */
+void RenderThread::reset(const Canvas &image)
+{
+    PaintOp op(PaintOp::reset);
+    op.canvas = image;
+    post(op);
+}
+
+/**
+ * @brief RenderThread::waitForIdle - Block until the queue is drawn. Only
+ *                                    used before the image is changed by
+ *                                    something other than a stroke.
+ *
+ */
+void RenderThread::waitForIdle()
+{
+    QMutexLocker locker(&mutex);
+    while(busy)
+        idle.wait(&mutex);
+}
+
+/**
+ * @brief RenderThread::takeTiles - Put the published tiles on the GUI
+ *                                  thread's canvas
+ *
+ */
+QRect RenderThread::takeTiles(Canvas *image)
+{
+    QMutexLocker locker(&mutex);
+    for(QHash<int, QImage>::const_iterator i = publishedTiles.constBegin();
+        i != publishedTiles.constEnd(); ++i)
+    {
+        if(i.key() < image->tileCount())
+            image->tile(i.key()) = i.value();
+    }
+    publishedTiles.clear();
+
+    QRect area = publishedArea;
+    publishedArea = QRect();
+    return area;
+}
+
+/**
+ * @brief RenderThread::takeFinishedStroke - Pop the oldest finished stroke
+ *
+ */
+bool RenderThread::takeFinishedStroke(Canvas *before, Canvas *after,
+                                      QRect *area)
+{
+    QMutexLocker locker(&mutex);
+    if(finishedStrokes.isEmpty())
+        return false;
+
+    FinishedStroke stroke = finishedStrokes.dequeue();
+    *before = stroke.before;
+    *after = stroke.after;
+    *area = stroke.area;
+    return true;
+}
+
+/**
+ * @brief RenderThread::run - Draw queued calls as they come. Tiles are
+ *                            handed over whenever the queue runs dry, and
+ *                            every few milliseconds during a long stroke.
+ *
+ */
+void RenderThread::run()
+{
+    QElapsedTimer sincePublish;
+    sincePublish.start();
+
+    forever
+    {
+        mutex.lock();
+        while(queue.isEmpty() && !quit)
+        {
+            busy = false;
+            idle.wakeAll();
+            workQueued.wait(&mutex);
+        }
+        if(quit)
+        {
+            mutex.unlock();
+            return;
+        }
+        PaintOp op = queue.dequeue();
+        bool more = !queue.isEmpty();
+        mutex.unlock();
+
+        replay(op);
+
+        if(op.type == PaintOp::end_stroke ||
+           (!unpublished.isEmpty() && (!more || sincePublish.elapsed() >= PUBLISH_INTERVAL)))
+        {
+            publish(op.type == PaintOp::end_stroke);
+            sincePublish.restart();
+        }
+    }
+}
+
+/**
+ * @brief RenderThread::replay - Make a queued call on the real painter
+ *
+ */
+void RenderThread::replay(const PaintOp &op)
+{
+    switch(op.type)
+    {
+        case PaintOp::reset:
+            working = op.canvas;
+            return;
+        case PaintOp::begin_stroke:
+            before = working;
+            painter = new CanvasPainter(&working);
+            return;
+        case PaintOp::end_stroke:
+            return;
+        default:
+            break;
+    }
+    if(!painter)
+        return;
+
+    switch(op.type)
+    {
+        case PaintOp::set_pen: painter->setPen(op.pen);                  break;
+        case PaintOp::set_brush: painter->setBrush(op.brush);            break;
+        case PaintOp::set_composition_mode:
+            painter->setCompositionMode(op.mode);                        break;
+        case PaintOp::draw_line:
+            painter->drawLine(op.points[0], op.points[1]);               break;
+        case PaintOp::draw_polyline: painter->drawPolyline(op.points);   break;
+        case PaintOp::draw_rect: painter->drawRect(op.rect);             break;
+        case PaintOp::fill_rect: painter->fillRect(op.rect, op.color);   break;
+        case PaintOp::draw_rounded_rect:
+            painter->drawRoundedRect(op.rect, op.xRadius, op.yRadius,
+                                     op.sizeMode);                       break;
+        case PaintOp::draw_ellipse: painter->drawEllipse(op.rect);       break;
+        case PaintOp::draw_image:
+            painter->drawImage(op.rect.topLeft(), op.image);             break;
+        case PaintOp::stamp_polyline:
+            painter->stampPolyline(op.points, op.spacing);               break;
+        case PaintOp::flood_fill:
+            painter->floodFill(op.points[0], op.color, op.tolerance);    break;
+        default:                                                         break;
+    }
+
+    unpublished |= painter->lastPaintedArea();
+}
+
+/**
+ * @brief RenderThread::publish - Hand the tiles drawn on since the last
+ *                                time over to the GUI thread. Mid-stroke
+ *                                the tiles still have painters open on
+ *                                them, so copies are handed over; at the
+ *                                end the tiles themselves are shared.
+ *
+ */
+void RenderThread::publish(bool final)
+{
+    QRect area = unpublished;
+    unpublished = QRect();
+
+    QRect strokeArea;
+    if(final && painter)
+    {
+        strokeArea = painter->paintedArea();
+        delete painter;
+        painter = 0;
+    }
+
+    QHash<int, QImage> tiles;
+    QVector<int> indexes = working.tilesIn(area);
+    for(int i = 0; i < indexes.size(); ++i)
+    {
+        const QImage &tile = working.tile(indexes[i]);
+        tiles.insert(indexes[i], final ? tile : tile.copy());
+    }
+
+    mutex.lock();
+    for(QHash<int, QImage>::const_iterator i = tiles.constBegin();
+        i != tiles.constEnd(); ++i)
+        publishedTiles.insert(i.key(), i.value());
+    publishedArea |= area;
+    if(final)
+    {
+        // the painter is gone, so the copy only shares the tiles
+        FinishedStroke stroke;
+        stroke.before = before;
+        stroke.after = working;
+        stroke.area = strokeArea;
+        finishedStrokes.enqueue(stroke);
+    }
+    mutex.unlock();
+
+    if(final)
+        before = Canvas();
+    if(!area.isEmpty() || final)
+        emit resultsReady();
+}
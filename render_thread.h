@@ -0,0 +1,123 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <QHash>
+#include <QMutex>
+#include <QPen>
+#include <QPolygon>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "canvas.h"
+
+
+/**
+ * One call made on a recording CanvasPainter, to be replayed on the
+ * render thread.
+ */
+struct PaintOp
+{
+    enum Type { set_pen, set_brush, set_composition_mode, draw_line,
+                draw_polyline, draw_rect, fill_rect, draw_rounded_rect,
+                draw_ellipse, draw_image, stamp_polyline, flood_fill,
+                begin_stroke, end_stroke, reset };
+
+    explicit PaintOp(Type t = reset)
+        : type(t), mode(QPainter::CompositionMode_SourceOver),
+          xRadius(0), yRadius(0), sizeMode(Qt::AbsoluteSize), spacing(0),
+          tolerance(0) {}
+
+    Type type;
+    QPen pen;
+    QBrush brush;
+    QPainter::CompositionMode mode;
+    QPolygon points;
+    QRect rect;
+    QColor color;
+    qreal xRadius, yRadius;
+    Qt::SizeMode sizeMode;
+    qreal spacing;
+    int tolerance;
+    QImage image;
+    Canvas canvas;
+};
+
+/**
+ * A stroke the render thread is done with: the canvas before and after
+ * it, which share all the tiles it didn't draw on, & the area it drew on.
+ */
+struct FinishedStroke
+{
+    Canvas before;
+    Canvas after;
+    QRect area;
+};
+
+/**
+ * Rasterizes strokes away from the GUI thread. The GUI thread queues the
+ * drawing calls of a stroke; the thread draws them on its own copy of the
+ * canvas and publishes the tiles it changed, which the GUI thread picks up
+ * when resultsReady() is emitted. Strokes are drawn in the order they were
+ * queued, and each finished stroke comes with the canvas it started from
+ * and the one it left, for the undo stack.
+ */
+class RenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit RenderThread(QObject *parent = 0);
+    ~RenderThread();
+
+    /** GUI thread: queue work */
+    void post(const PaintOp &op);
+    void beginStroke() { post(PaintOp(PaintOp::begin_stroke)); }
+    void endStroke() { post(PaintOp(PaintOp::end_stroke)); }
+    void reset(const Canvas &image);
+
+    /** GUI thread: block until everything queued has been drawn */
+    void waitForIdle();
+
+    /** GUI thread: copy the tiles drawn since the last call into image,
+     *  returns the area they changed */
+    QRect takeTiles(Canvas *image);
+
+    /** GUI thread: the next finished stroke, the canvas it started from,
+     *  the canvas it left & the area it drew on, which is empty if it drew
+     *  nothing */
+    bool takeFinishedStroke(Canvas *before, Canvas *after, QRect *area);
+
+signals:
+    void resultsReady();
+
+protected:
+    void run() override;
+
+private:
+    void replay(const PaintOp &op);
+    void publish(bool final);
+
+    /** shared with the GUI thread, guarded by mutex */
+    QMutex mutex;
+    QWaitCondition workQueued;
+    QWaitCondition idle;
+    QQueue<PaintOp> queue;
+    bool busy;
+    bool quit;
+    QHash<int, QImage> publishedTiles;
+    QRect publishedArea;
+    QQueue<FinishedStroke> finishedStrokes;
+
+    /** only touched by the render thread */
+    Canvas working;
+    Canvas before;
+    CanvasPainter* painter;
+    QRect unpublished;
+
+    /** Don't allow copying */
+    RenderThread(const RenderThread&);
+    RenderThread& operator=(const RenderThread&);
+};
+
+#endif // RENDER_THREAD_H
@@ -0,0 +1,307 @@
+#include <cmath>
+
+#include <QtConcurrent>
+
+#include "resample.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define RESAMPLE_SSE2
+#endif
+
+
+/** rows in a band of work */
+static const int BAND_ROWS = 32;
+
+/**
+ * @brief filterSupport - How far from its center a filter reaches, in
+ *                        source pixels at full size
+ *
+ */
+static double filterSupport(ResizeFilter filter)
+{
+    switch(filter)
+    {
+        case bilinear_filter: return 1;
+        case bicubic_filter: return 2;
+        case lanczos3_filter: return 3;
+        default: return 0.5;
+    }
+}
+
+static double sinc(double x)
+{
+    if(x == 0)
+        return 1;
+    x *= M_PI;
+    return std::sin(x) / x;
+}
+
+/**
+ * @brief filterWeight - The filter at a distance from its center: a tent
+ *                       for bilinear, Catmull-Rom (a = -0.5) for bicubic,
+ *                       and a three lobed windowed sinc for Lanczos
+ *
+ */
+static double filterWeight(ResizeFilter filter, double x)
+{
+    const double a = -0.5;
+    x = std::fabs(x);
+    switch(filter)
+    {
+        case bilinear_filter:
+            return x < 1 ? 1 - x : 0;
+        case bicubic_filter:
+            if(x < 1)
+                return ((a + 2) * x - (a + 3)) * x * x + 1;
+            if(x < 2)
+                return ((a * x - 5 * a) * x + 8 * a) * x - 4 * a;
+            return 0;
+        case lanczos3_filter:
+            return x < 3 ? sinc(x) * sinc(x / 3) : 0;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief Resampler::makeTaps - Weights for resampling one axis. Output
+ *                              pixel i is centered on (i + 0.5) * scale in
+ *                              the source; its weights are normalized so a
+ *                              flat color stays flat, also at the edges.
+ *
+ */
+Resampler::Taps Resampler::makeTaps(int from, int to, ResizeFilter filter)
+{
+    const double scale = double(from) / to;
+    const double filterScale = qMax(scale, 1.0);
+    const double support = filterSupport(filter) * filterScale;
+
+    Taps taps;
+    taps.stride = filter == nearest_filter ? 1 : int(std::ceil(support)) * 2 + 1;
+    taps.first.resize(to);
+    taps.count.resize(to);
+    taps.weights.fill(0, to * taps.stride);
+
+    for(int i = 0; i < to; ++i)
+    {
+        double center = (i + 0.5) * scale;
+        float *weights = taps.weights.data() + i * taps.stride;
+
+        if(filter == nearest_filter)
+        {
+            taps.first[i] = qBound(0, int(center), from - 1);
+            taps.count[i] = 1;
+            weights[0] = 1;
+            continue;
+        }
+
+        int low = qMax(int(center - support + 0.5), 0);
+        int high = qMin(int(center + support + 0.5), from);
+        high = qMin(high, low + taps.stride);
+
+        double sum = 0;
+        for(int j = low; j < high; ++j)
+        {
+            double w = filterWeight(filter, (j - center + 0.5) / filterScale);
+            weights[j - low] = float(w);
+            sum += w;
+        }
+        if(sum != 0)
+            for(int j = low; j < high; ++j)
+                weights[j - low] = float(weights[j - low] / sum);
+
+        taps.first[i] = low;
+        taps.count[i] = high - low;
+    }
+    return taps;
+}
+
+/**
+ * @brief Resampler::Resampler - Sets up the weights and the images; the
+ *                               passes do the work
+ *
+ */
+Resampler::Resampler(const QImage &image, const QSize &size,
+                     ResizeFilter filter)
+{
+    // filtering premultiplied pixels keeps transparent colors from bleeding
+    source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    middle = QImage(size.width(), source.height(),
+                    QImage::Format_ARGB32_Premultiplied);
+    target = QImage(size, QImage::Format_ARGB32_Premultiplied);
+    middleBits = middle.bits();
+    targetBits = target.bits();
+
+    horizontal = makeTaps(source.width(), size.width(), filter);
+    vertical = makeTaps(source.height(), size.height(), filter);
+}
+
+int Resampler::horizontalBands() const
+{
+    return (middle.height() + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+int Resampler::verticalBands() const
+{
+    return (target.height() + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+/**
+ * @brief clampPixel - Filters with negative lobes can overshoot; keep
+ *                     the channels in range, and the colors no brighter
+ *                     than the alpha, as premultiplied pixels must be
+ *
+ */
+static inline quint32 clampPixel(quint32 pixel)
+{
+    quint32 alpha = pixel >> 24;
+    quint32 r = qMin((pixel >> 16) & 0xff, alpha);
+    quint32 g = qMin((pixel >> 8) & 0xff, alpha);
+    quint32 b = qMin(pixel & 0xff, alpha);
+    return (alpha << 24) | (r << 16) | (g << 8) | b;
+}
+
+#ifdef RESAMPLE_SSE2
+static inline __m128 loadPixel(quint32 pixel)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i p = _mm_cvtsi32_si128(int(pixel));
+    p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+    return _mm_cvtepi32_ps(p);
+}
+
+static inline quint32 storePixel(__m128 channels)
+{
+    // round, then saturate to 0-255 on the way down to bytes
+    __m128i p = _mm_cvtps_epi32(channels);
+    p = _mm_packs_epi32(p, p);
+    p = _mm_packus_epi16(p, p);
+    return clampPixel(quint32(_mm_cvtsi128_si32(p)));
+}
+#else
+static inline quint32 storePixel(const float *channels)
+{
+    quint32 pixel = 0;
+    for(int c = 0; c < 4; ++c)
+        pixel |= quint32(qBound(0, qRound(channels[c]), 255)) << (8 * c);
+    return clampPixel(pixel);
+}
+#endif
+
+/**
+ * @brief Resampler::horizontalPass - Resamples the rows of a band of the
+ *                                    source across, into the middle image.
+ *                                    A pixel's channels are summed as one
+ *                                    vector of four floats.
+ *
+ */
+void Resampler::horizontalPass(int band)
+{
+    const int width = middle.width();
+    const int bytesPerLine = middle.bytesPerLine();
+    const int last = qMin((band + 1) * BAND_ROWS, middle.height());
+
+    for(int y = band * BAND_ROWS; y < last; ++y)
+    {
+        const quint32 *src = reinterpret_cast<const quint32*>(source.constScanLine(y));
+        quint32 *dst = reinterpret_cast<quint32*>(middleBits + y * bytesPerLine);
+
+        for(int x = 0; x < width; ++x)
+        {
+            const quint32 *in = src + horizontal.first[x];
+            const float *weights = horizontal.weights.constData() + x * horizontal.stride;
+            const int count = horizontal.count[x];
+#ifdef RESAMPLE_SSE2
+            __m128 sum = _mm_setzero_ps();
+            for(int k = 0; k < count; ++k)
+                sum = _mm_add_ps(sum, _mm_mul_ps(loadPixel(in[k]),
+                                                 _mm_set1_ps(weights[k])));
+            dst[x] = storePixel(sum);
+#else
+            float sum[4] = { 0, 0, 0, 0 };
+            for(int k = 0; k < count; ++k)
+                for(int c = 0; c < 4; ++c)
+                    sum[c] += ((in[k] >> (8 * c)) & 0xff) * weights[k];
+            dst[x] = storePixel(sum);
+#endif
+        }
+    }
+}
+
+/**
+ * @brief Resampler::verticalPass - Resamples the middle image down into
+ *                                  a band of the result. Whole source rows
+ *                                  are weighted and added into a row of
+ *                                  float sums, so memory is read in order.
+ *
+ */
+void Resampler::verticalPass(int band)
+{
+    const int width = target.width();
+    const int middleBpl = middle.bytesPerLine();
+    const int targetBpl = target.bytesPerLine();
+    const int last = qMin((band + 1) * BAND_ROWS, target.height());
+    QVector<float> sums(width * 4);
+
+    for(int y = band * BAND_ROWS; y < last; ++y)
+    {
+        sums.fill(0);
+        float *sum = sums.data();
+        const float *weights = vertical.weights.constData() + y * vertical.stride;
+
+        for(int k = 0; k < vertical.count[y]; ++k)
+        {
+            const quint32 *src = reinterpret_cast<const quint32*>(
+                        middleBits + (vertical.first[y] + k) * middleBpl);
+#ifdef RESAMPLE_SSE2
+            const __m128 w = _mm_set1_ps(weights[k]);
+            for(int x = 0; x < width; ++x)
+                _mm_storeu_ps(sum + 4 * x,
+                              _mm_add_ps(_mm_loadu_ps(sum + 4 * x),
+                                         _mm_mul_ps(loadPixel(src[x]), w)));
+#else
+            for(int x = 0; x < width; ++x)
+                for(int c = 0; c < 4; ++c)
+                    sum[4 * x + c] += ((src[x] >> (8 * c)) & 0xff) * weights[k];
+#endif
+        }
+
+        quint32 *dst = reinterpret_cast<quint32*>(targetBits + y * targetBpl);
+        for(int x = 0; x < width; ++x)
+        {
+#ifdef RESAMPLE_SSE2
+            dst[x] = storePixel(_mm_loadu_ps(sum + 4 * x));
+#else
+            dst[x] = storePixel(sum + 4 * x);
+#endif
+        }
+    }
+}
+
+/**
+ * @brief Resampler::scaled - Resizes an image in one call, blocking until
+ *                            both passes are done on all cores
+ *
+ */
+QImage Resampler::scaled(const QImage &image, const QSize &size,
+                         ResizeFilter filter)
+{
+    Resampler resampler(image, size, filter);
+
+    QVector<int> bands;
+    for(int i = 0; i < resampler.horizontalBands(); ++i)
+        bands.append(i);
+    QtConcurrent::blockingMap(bands, [&resampler](int &band) {
+        resampler.horizontalPass(band);
+    });
+
+    bands.clear();
+    for(int i = 0; i < resampler.verticalBands(); ++i)
+        bands.append(i);
+    QtConcurrent::blockingMap(bands, [&resampler](int &band) {
+        resampler.verticalPass(band);
+    });
+
+    return resampler.result();
+}
@@ -0,0 +1,63 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <QImage>
+#include <QVector>
+
+#include "constants.h"
+
+
+/**
+ * Resizes an image with a separable filter: a horizontal pass from the
+ * source into an image as tall as the source, then a vertical pass from
+ * that into the result. Each pass is split into bands of rows that may be
+ * run on any thread and in any order, but all of the first pass has to be
+ * done before the second starts. When shrinking, the filter is widened so
+ * every source pixel counts towards the result.
+ */
+class Resampler
+{
+public:
+    Resampler(const QImage &source, const QSize &size, ResizeFilter filter);
+
+    /** the bands of each pass */
+    int horizontalBands() const;
+    int verticalBands() const;
+    void horizontalPass(int band);
+    void verticalPass(int band);
+
+    QImage result() const { return target; }
+
+    /** both passes, spread over the global thread pool */
+    static QImage scaled(const QImage &image, const QSize &size,
+                         ResizeFilter filter);
+
+private:
+    /** for each pixel along an axis, the source pixels it is made of and
+     *  their weights; weights are stride apart */
+    struct Taps
+    {
+        QVector<int> first;
+        QVector<int> count;
+        QVector<float> weights;
+        int stride;
+    };
+    static Taps makeTaps(int from, int to, ResizeFilter filter);
+
+    QImage source;
+    QImage middle;
+    QImage target;
+    Taps horizontal;
+    Taps vertical;
+
+    /** the pixels of middle & target, taken once so threads don't call
+     *  the detaching QImage accessors */
+    uchar* middleBits;
+    uchar* targetBits;
+
+    /** Don't allow copying */
+    Resampler(const Resampler&);
+    Resampler& operator=(const Resampler&);
+};
+
+#endif // RESAMPLE_H
@@ -0,0 +1,17 @@
+QT = core gui concurrent testlib
+CONFIG += testcase warn_on
+TARGET = tst_bmp_reader
+INCLUDEPATH += ../..
+
+HEADERS += ../../bmp_reader.h \
+    ../../canvas.h \
+    ../../brush_engine.h \
+    ../../constants.h \
+    ../../flood_fill.h \
+    ../../render_thread.h
+SOURCES += tst_bmp_reader.cpp \
+    ../../bmp_reader.cpp \
+    ../../canvas.cpp \
+    ../../brush_engine.cpp \
+    ../../flood_fill.cpp \
+    ../../render_thread.cpp
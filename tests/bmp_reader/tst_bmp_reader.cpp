@@ -0,0 +1,90 @@
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "bmp_reader.h"
+
+
+/**
+ * BmpReader, decoding a memory map of the file into the canvas's tiles,
+ * against QImage reading the file and the canvas being made from that.
+ */
+class TestBmpReader : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void loadSpeed_data();
+    void loadSpeed();
+
+private:
+    QTemporaryDir dir;
+    QString fileName;
+};
+
+/** a 1440p screen's worth of pixels */
+static const QSize BENCHMARK_SIZE(2560, 1440);
+
+/**
+ * @brief TestBmpReader::initTestCase - Saves a 24-bit, bottom-up BMP of
+ *                                      the benchmark size with QImage, as
+ *                                      most BMPs are
+ *
+ */
+void TestBmpReader::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    fileName = dir.filePath("benchmark.bmp");
+
+    QImage image(BENCHMARK_SIZE, QImage::Format_RGB32);
+    for(int y = 0; y < image.height(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for(int x = 0; x < image.width(); ++x)
+            line[x] = qRgb(x & 0xff, y & 0xff, (x ^ y) & 0xff);
+    }
+    QVERIFY(image.save(fileName, "BMP"));
+}
+
+void TestBmpReader::loadSpeed_data()
+{
+    QTest::addColumn<bool>("reader");
+
+    QTest::newRow("BmpReader") << true;
+    QTest::newRow("QImage::load") << false;
+}
+
+/**
+ * @brief TestBmpReader::loadSpeed - Reads the file into a canvas, either
+ *                                   with BmpReader or by loading it into
+ *                                   a QImage and splitting that into
+ *                                   tiles, as opening an image did before
+ *
+ */
+void TestBmpReader::loadSpeed()
+{
+    QFETCH(bool, reader);
+
+    Canvas canvas;
+    if(reader)
+    {
+        QBENCHMARK {
+            BmpReader bmp(fileName);
+            QVERIFY2(bmp.open(), qPrintable(bmp.errorString()));
+            bmp.readAll();
+            canvas = bmp.result();
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            QImage image;
+            QVERIFY(image.load(fileName));
+            canvas = Canvas(image);
+        }
+    }
+    QCOMPARE(canvas.size(), BENCHMARK_SIZE);
+}
+
+QTEST_MAIN(TestBmpReader)
+#include "tst_bmp_reader.moc"
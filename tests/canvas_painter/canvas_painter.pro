@@ -0,0 +1,15 @@
+QT = core gui testlib
+CONFIG += testcase warn_on
+TARGET = tst_canvas_painter
+INCLUDEPATH += ../..
+
+HEADERS += ../../canvas.h \
+    ../../brush_engine.h \
+    ../../constants.h \
+    ../../flood_fill.h \
+    ../../render_thread.h
+SOURCES += tst_canvas_painter.cpp \
+    ../../canvas.cpp \
+    ../../brush_engine.cpp \
+    ../../flood_fill.cpp \
+    ../../render_thread.cpp
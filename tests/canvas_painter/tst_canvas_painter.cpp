@@ -0,0 +1,294 @@
+#include <QtMath>
+#include <QtTest>
+
+#include "canvas.h"
+
+
+/**
+ * CanvasPainter, drawing straight onto the canvas, against QPainter
+ * drawing the same calls onto a single image.
+ */
+class TestCanvasPainter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void thinLinesMatchQPainter_data();
+    void thinLinesMatchQPainter();
+    void thinPolylinesMatchQPainter();
+    void strokeSpeed_data();
+    void strokeSpeed();
+    void stampSpeed_data();
+    void stampSpeed();
+};
+
+/** the canvas is three tiles square less a bit, so lines cross tile
+ *  edges and the smaller tiles along the right and bottom */
+static const QSize CANVAS_SIZE(3 * TILE_SIZE - 37, 3 * TILE_SIZE - 11);
+
+/**
+ * @brief lines - A fan of slopes from points in the middle, on tile edges
+ *                and off the canvas, both ways round, and random lines of
+ *                every length
+ *
+ */
+static QVector<QLine> lines()
+{
+    QVector<QLine> result;
+
+    QList<QPoint> centers;
+    centers << QPoint(150, 150) << QPoint(TILE_SIZE, TILE_SIZE - 1)
+            << QPoint(0, 0) << QPoint(-20, 60)
+            << QPoint(CANVAS_SIZE.width() - 1, CANVAS_SIZE.height() + 5);
+    for(int i = 0; i < centers.size(); ++i)
+    {
+        QPoint c = centers.at(i);
+        for(int d = -40; d <= 40; d += 3)
+        {
+            QList<QPoint> ends;
+            ends << c + QPoint(40, d) << c + QPoint(d, 40)
+                 << c + QPoint(-40, d) << c + QPoint(d, -40);
+            for(int j = 0; j < ends.size(); ++j)
+            {
+                result << QLine(c, ends.at(j)) << QLine(ends.at(j), c);
+            }
+        }
+
+        // the shortest lines and a single point
+        for(int dx = -2; dx <= 2; ++dx)
+            for(int dy = -2; dy <= 2; ++dy)
+                result << QLine(c, c + QPoint(dx, dy));
+    }
+
+    QRandomGenerator random(16);
+    for(int i = 0; i < 300; ++i)
+    {
+        QPoint a(random.bounded(CANVAS_SIZE.width() + 40) - 20,
+                 random.bounded(CANVAS_SIZE.height() + 40) - 20);
+        QPoint b(random.bounded(CANVAS_SIZE.width() + 40) - 20,
+                 random.bounded(CANVAS_SIZE.height() + 40) - 20);
+        result << QLine(a, b);
+    }
+    return result;
+}
+
+/**
+ * @brief reference - The canvas's starting image, with QPainter having
+ *                    drawn the lines on it
+ *
+ */
+static QImage reference(const QPen &pen, const QVector<QLine> &lines)
+{
+    QImage image(CANVAS_SIZE, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+    painter.setPen(pen);
+    for(int i = 0; i < lines.size(); ++i)
+        painter.drawLine(lines.at(i));
+    return image;
+}
+
+void TestCanvasPainter::thinLinesMatchQPainter_data()
+{
+    QTest::addColumn<qreal>("width");
+    QTest::addColumn<int>("cap");
+
+    QTest::newRow("cosmetic flat") << qreal(0) << int(Qt::FlatCap);
+    QTest::newRow("cosmetic square") << qreal(0) << int(Qt::SquareCap);
+    QTest::newRow("cosmetic round") << qreal(0) << int(Qt::RoundCap);
+    QTest::newRow("1px flat") << qreal(1) << int(Qt::FlatCap);
+    QTest::newRow("1px square") << qreal(1) << int(Qt::SquareCap);
+    QTest::newRow("1px round") << qreal(1) << int(Qt::RoundCap);
+}
+
+/**
+ * @brief TestCanvasPainter::thinLinesMatchQPainter - Lines written straight
+ *                                                    into the tiles have the
+ *                                                    same pixels as QPainter
+ *                                                    draws, one line at a
+ *                                                    time so a mismatch
+ *                                                    names the line
+ *
+ */
+void TestCanvasPainter::thinLinesMatchQPainter()
+{
+    QFETCH(qreal, width);
+    QFETCH(int, cap);
+
+    QPen pen(QColor(200, 30, 60), width, Qt::SolidLine,
+             Qt::PenCapStyle(cap), Qt::RoundJoin);
+    QVector<QLine> all = lines();
+    for(int i = 0; i < all.size(); ++i)
+    {
+        const QLine &line = all.at(i);
+        Canvas canvas(CANVAS_SIZE, Qt::white);
+        {
+            CanvasPainter painter(&canvas);
+            painter.setPen(pen);
+            painter.drawLine(line.p1(), line.p2());
+        }
+
+        QImage expected = reference(pen, QVector<QLine>() << line);
+        if(canvas.toImage() != expected)
+            QFAIL(qPrintable(QString("line (%1, %2) - (%3, %4) differs")
+                             .arg(line.x1()).arg(line.y1())
+                             .arg(line.x2()).arg(line.y2())));
+    }
+}
+
+/**
+ * @brief TestCanvasPainter::thinPolylinesMatchQPainter - A polyline is
+ *                                                        drawn as its
+ *                                                        segments one
+ *                                                        after another
+ *
+ */
+void TestCanvasPainter::thinPolylinesMatchQPainter()
+{
+    QPen pen(Qt::black, 1, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+    QVector<QLine> all = lines();
+
+    QPolygon points;
+    QVector<QLine> segments;
+    points << all.first().p1();
+    for(int i = 0; i < all.size(); i += 7)
+    {
+        segments << QLine(points.last(), all.at(i).p2());
+        points << all.at(i).p2();
+    }
+
+    Canvas canvas(CANVAS_SIZE, Qt::white);
+    {
+        CanvasPainter painter(&canvas);
+        painter.setPen(pen);
+        painter.drawPolyline(points);
+    }
+    QVERIFY(canvas.toImage() == reference(pen, segments));
+}
+
+/** the benchmarks draw on a canvas a 1440p screen in size */
+static const QSize BENCHMARK_SIZE(2560, 1440);
+
+/**
+ * @brief strokeSamples - The mouse moves of a quick wavy stroke across the
+ *                        canvas, a few pixels apart
+ *
+ */
+static QPolygon strokeSamples()
+{
+    QPolygon samples;
+    for(int i = 0; i < 600; ++i)
+        samples << QPoint(100 + 4 * i, 700 + qRound(400 * qSin(i / 40.0)));
+    return samples;
+}
+
+void TestCanvasPainter::strokeSpeed_data()
+{
+    QTest::addColumn<bool>("session");
+    QTest::addColumn<qreal>("width");
+
+    QTest::newRow("1px, painter per sample") << false << qreal(1);
+    QTest::newRow("1px, painter per stroke") << true << qreal(1);
+    QTest::newRow("5px, painter per sample") << false << qreal(5);
+    QTest::newRow("5px, painter per stroke") << true << qreal(5);
+}
+
+/**
+ * @brief TestCanvasPainter::strokeSpeed - A stroke drawn a segment per
+ *                                         mouse move, with a QPainter
+ *                                         begun on the image for each one
+ *                                         as the tools used to, or with
+ *                                         one CanvasPainter kept from press
+ *                                         to release. The time is for the
+ *                                         whole stroke; divide by its 600
+ *                                         samples for the cost of each.
+ *
+ */
+void TestCanvasPainter::strokeSpeed()
+{
+    QFETCH(bool, session);
+    QFETCH(qreal, width);
+
+    QPen pen(QColor(20, 90, 200), width, Qt::SolidLine, Qt::FlatCap,
+             Qt::BevelJoin);
+    QPolygon samples = strokeSamples();
+
+    if(session)
+    {
+        Canvas canvas(BENCHMARK_SIZE, Qt::white);
+        QBENCHMARK {
+            CanvasPainter painter(&canvas);
+            painter.setPen(pen);
+            for(int i = 1; i < samples.size(); ++i)
+                painter.drawLine(samples[i - 1], samples[i]);
+        }
+    }
+    else
+    {
+        QPixmap pixmap(BENCHMARK_SIZE);
+        pixmap.fill(Qt::white);
+        QBENCHMARK {
+            for(int i = 1; i < samples.size(); ++i)
+            {
+                QPainter painter(&pixmap);
+                painter.setPen(pen);
+                painter.drawLine(samples[i - 1], samples[i]);
+            }
+        }
+    }
+}
+
+void TestCanvasPainter::stampSpeed_data()
+{
+    QTest::addColumn<bool>("stamp");
+    QTest::addColumn<qreal>("width");
+    QTest::addColumn<int>("cap");
+
+    QList<int> widths;
+    widths << 8 << 24 << MAX_PEN_SIZE;
+    for(int i = 0; i < widths.size(); ++i)
+    {
+        QString width = QString("%1px ").arg(widths.at(i));
+        QTest::newRow(qPrintable(width + "round, dabs"))
+            << true << qreal(widths.at(i)) << int(Qt::RoundCap);
+        QTest::newRow(qPrintable(width + "round, QPainter"))
+            << false << qreal(widths.at(i)) << int(Qt::RoundCap);
+        QTest::newRow(qPrintable(width + "square, dabs"))
+            << true << qreal(widths.at(i)) << int(Qt::SquareCap);
+        QTest::newRow(qPrintable(width + "square, QPainter"))
+            << false << qreal(widths.at(i)) << int(Qt::SquareCap);
+    }
+}
+
+/**
+ * @brief TestCanvasPainter::stampSpeed - A wide pen's stroke stamped with
+ *                                        the brush engine's dabs, against
+ *                                        the same stroke through QPainter
+ *                                        as a polyline, both onto the
+ *                                        canvas's tiles
+ *
+ */
+void TestCanvasPainter::stampSpeed()
+{
+    QFETCH(bool, stamp);
+    QFETCH(qreal, width);
+    QFETCH(int, cap);
+
+    QPen pen(QColor(20, 90, 200), width, Qt::SolidLine,
+             Qt::PenCapStyle(cap),
+             cap == Qt::RoundCap ? Qt::RoundJoin : Qt::MiterJoin);
+    QPolygon samples = strokeSamples();
+
+    Canvas canvas(BENCHMARK_SIZE, Qt::white);
+    QBENCHMARK {
+        CanvasPainter painter(&canvas);
+        painter.setPen(pen);
+        if(stamp)
+            painter.stampPolyline(samples, DEFAULT_DAB_SPACING);
+        else
+            painter.drawPolyline(samples);
+    }
+}
+
+QTEST_MAIN(TestCanvasPainter)
+#include "tst_canvas_painter.moc"
@@ -0,0 +1,14 @@
+QT = core gui testlib
+CONFIG += testcase warn_on
+TARGET = tst_image_diff
+INCLUDEPATH += ../..
+
+HEADERS += ../../image_diff.h
+SOURCES += tst_image_diff.cpp \
+    ../../image_diff.cpp
+
+# build with CONFIG+=avx2 to test the AVX2 image kernels
+avx2 {
+    gcc|clang: QMAKE_CXXFLAGS += -mavx2
+    msvc: QMAKE_CXXFLAGS += /arch:AVX2
+}
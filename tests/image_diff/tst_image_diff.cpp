@@ -0,0 +1,327 @@
+#include <cstring>
+
+#include <QtTest>
+
+#include "image_diff.h"
+
+
+/**
+ * The image_diff kernels, in whichever variant this build compiled in.
+ */
+class TestImageDiff : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void hashSeesMovedPixels();
+    void hashSeesSwappedRows();
+    void hashSeesSwappedPixels();
+    void hashSkipsPadding();
+    void diffRectBoundsChanges();
+    void diffRectSpeed_data();
+    void diffRectSpeed();
+    void hashSpeed_data();
+    void hashSpeed();
+};
+
+/** a 1440p screen's worth of pixels, as large as the canvases drawn on */
+static const QSize BENCHMARK_SIZE(2560, 1440);
+
+/**
+ * @brief block - A white tile with a black 16x16 block at a point
+ *
+ */
+static QImage block(const QPoint &at, const QSize &size = QSize(128, 128))
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    for(int y = at.y(); y < at.y() + 16; ++y)
+        for(int x = at.x(); x < at.x() + 16; ++x)
+            image.setPixel(x, y, qRgb(0, 0, 0));
+    return image;
+}
+
+/**
+ * @brief TestImageDiff::hashSeesMovedPixels - The same block anywhere else
+ *                                             in the tile, along a row,
+ *                                             down a column or by less
+ *                                             than a stripe, hashes
+ *                                             differently
+ *
+ */
+void TestImageDiff::hashSeesMovedPixels()
+{
+    QList<QPoint> places;
+    places << QPoint(0, 0) << QPoint(16, 0) << QPoint(0, 112)
+           << QPoint(112, 112) << QPoint(1, 0) << QPoint(0, 1)
+           << QPoint(64, 32);
+
+    QSet<quint64> hashes;
+    for(int i = 0; i < places.size(); ++i)
+        hashes.insert(contentHash(block(places.at(i))));
+    QCOMPARE(hashes.size(), places.size());
+
+    // and on an edge tile whose rows end in leftover pixels
+    QSize edge(75, 40);
+    QVERIFY(contentHash(block(QPoint(0, 0), edge)) !=
+            contentHash(block(QPoint(48, 0), edge)));
+    QVERIFY(contentHash(block(QPoint(0, 0), edge)) !=
+            contentHash(block(QPoint(0, 24), edge)));
+}
+
+/**
+ * @brief TestImageDiff::hashSeesSwappedRows - Trading two rows of an image
+ *                                             changes the hash
+ *
+ */
+void TestImageDiff::hashSeesSwappedRows()
+{
+    QImage image(128, 128, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    for(int x = 0; x < image.width(); ++x)
+        image.setPixel(x, 10, qRgb(x, 0, 255 - x));
+
+    QImage swapped = image.copy();
+    for(int x = 0; x < image.width(); ++x)
+    {
+        swapped.setPixel(x, 10, image.pixel(x, 90));
+        swapped.setPixel(x, 90, image.pixel(x, 10));
+    }
+    QVERIFY(contentHash(image) != contentHash(swapped));
+}
+
+/**
+ * @brief TestImageDiff::hashSeesSwappedPixels - Trading two pixels of
+ *                                               random images of any size
+ *                                               changes the hash
+ *
+ */
+void TestImageDiff::hashSeesSwappedPixels()
+{
+    QRandomGenerator random(1);
+    for(int i = 0; i < 500; ++i)
+    {
+        QImage image(1 + random.bounded(150), 1 + random.bounded(40),
+                     QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::white);
+        for(int y = 0; y < image.height(); ++y)
+            for(int x = 0; x < image.width(); ++x)
+                if(random.bounded(4) == 0)
+                    image.setPixel(x, y, qRgb(random.bounded(256),
+                                              random.bounded(256),
+                                              random.bounded(256)));
+
+        QPoint a(random.bounded(image.width()),
+                 random.bounded(image.height()));
+        QPoint b(random.bounded(image.width()),
+                 random.bounded(image.height()));
+        if(image.pixel(a) == image.pixel(b))
+            continue;
+
+        QImage swapped = image.copy();
+        swapped.setPixel(a, image.pixel(b));
+        swapped.setPixel(b, image.pixel(a));
+        QVERIFY(contentHash(image) != contentHash(swapped));
+    }
+}
+
+/**
+ * @brief TestImageDiff::hashSkipsPadding - Only the visible pixels are
+ *                                          hashed, not the padding after
+ *                                          each row
+ *
+ */
+void TestImageDiff::hashSkipsPadding()
+{
+    QImage image = block(QPoint(5, 7), QSize(37, 20));
+    QByteArray padded(image.height() * 200, char(0x5a));
+    for(int y = 0; y < image.height(); ++y)
+        memcpy(padded.data() + y * 200, image.constScanLine(y), image.width() * 4);
+
+    QCOMPARE(contentHash(reinterpret_cast<const uchar*>(padded.constData()), 200,
+                         image.width(), image.height()),
+             contentHash(image));
+}
+
+/**
+ * @brief TestImageDiff::diffRectBoundsChanges - The box is the smallest
+ *                                               one around the pixels that
+ *                                               differ
+ *
+ */
+void TestImageDiff::diffRectBoundsChanges()
+{
+    QImage a = block(QPoint(0, 0));
+    QCOMPARE(diffRect(a, a.copy(), a.rect()), QRect());
+
+    QImage b = a.copy();
+    b.setPixel(3, 90, qRgb(1, 2, 3));
+    b.setPixel(100, 40, qRgb(1, 2, 3));
+    QCOMPARE(diffRect(a, b, a.rect()), QRect(QPoint(3, 40), QPoint(100, 90)));
+    QCOMPARE(diffRect(a, b, QRect(50, 0, 78, 128)), QRect(100, 40, 1, 1));
+}
+
+/**
+ * @brief noise - An image of the benchmark size filled with the same
+ *                pseudo-random pixels every time
+ *
+ */
+static QImage noise()
+{
+    QImage image(BENCHMARK_SIZE, QImage::Format_ARGB32_Premultiplied);
+    QRandomGenerator random(7);
+    for(int y = 0; y < image.height(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for(int x = 0; x < image.width(); ++x)
+            line[x] = random.generate() | 0xff000000;
+    }
+    return image;
+}
+
+/**
+ * @brief copyAndCompare - How the area that changed used to be found: both
+ *                         images are copied out and converted, then
+ *                         compared a row at a time for the first and last
+ *                         rows that differ and a pixel at a time between
+ *                         them for the columns
+ *
+ */
+static QRect copyAndCompare(const QImage &image1, const QImage &image2,
+                            const QRect &within)
+{
+    QImage a = image1.copy(within)
+                     .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage b = image2.copy(within)
+                     .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    int top = -1, bottom = -1;
+    for(int y = 0; y < a.height(); ++y)
+    {
+        if(memcmp(a.constScanLine(y), b.constScanLine(y), a.width() * 4))
+        {
+            if(top < 0)
+                top = y;
+            bottom = y;
+        }
+    }
+    if(top < 0)
+        return QRect();
+
+    int left = a.width(), right = -1;
+    for(int y = top; y <= bottom; ++y)
+    {
+        const QRgb *p = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        const QRgb *q = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for(int x = 0; x < left; ++x)
+            if(p[x] != q[x]) { left = x; break; }
+        for(int x = a.width() - 1; x > right; --x)
+            if(p[x] != q[x]) { right = x; break; }
+    }
+    return QRect(QPoint(left, top), QPoint(right, bottom))
+                .translated(within.topLeft());
+}
+
+/**
+ * @brief TestImageDiff::diffRectSpeed_data - Each way of finding what
+ *                                            changed, on images that are
+ *                                            the same, where every row is
+ *                                            compared to its end, and on
+ *                                            images where a stroke across
+ *                                            the middle changed
+ *
+ */
+void TestImageDiff::diffRectSpeed_data()
+{
+    QTest::addColumn<bool>("kernel");
+    QTest::addColumn<bool>("changed");
+
+    QTest::newRow("diffRect, same") << true << false;
+    QTest::newRow("copy and compare, same") << false << false;
+    QTest::newRow("diffRect, stroke") << true << true;
+    QTest::newRow("copy and compare, stroke") << false << true;
+}
+
+/**
+ * @brief TestImageDiff::diffRectSpeed - Finds the area that changed
+ *                                       between two 2560x1440 images
+ *
+ */
+void TestImageDiff::diffRectSpeed()
+{
+    QFETCH(bool, kernel);
+    QFETCH(bool, changed);
+
+    QImage before = noise();
+    QImage after = before.copy();
+    QRect stroke;
+    if(changed)
+    {
+        stroke = QRect(200, 600, 2000, 40);
+        for(int y = stroke.top(); y <= stroke.bottom(); ++y)
+            for(int x = stroke.left(); x <= stroke.right(); ++x)
+                after.setPixel(x, y, ~before.pixel(x, y) | 0xff000000);
+    }
+
+    QRect diff;
+    if(kernel)
+    {
+        QBENCHMARK {
+            diff = diffRect(before, after, before.rect());
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            diff = copyAndCompare(before, after, before.rect());
+        }
+    }
+    QCOMPARE(diff, stroke);
+}
+
+/**
+ * @brief TestImageDiff::hashSpeed_data - Telling whether a 2560x1440 image
+ *                                        changed by its hash, or by
+ *                                        comparing it with a copy kept of
+ *                                        it as QImage did
+ *
+ */
+void TestImageDiff::hashSpeed_data()
+{
+    QTest::addColumn<bool>("kernel");
+
+    QTest::newRow("contentHash") << true;
+    QTest::newRow("QImage ==") << false;
+}
+
+/**
+ * @brief TestImageDiff::hashSpeed - Checks an image that didn't change
+ *                                   against what it was
+ *
+ */
+void TestImageDiff::hashSpeed()
+{
+    QFETCH(bool, kernel);
+
+    QImage image = noise();
+    QImage kept = image.copy();
+    const quint64 hash = contentHash(image);
+
+    bool same = false;
+    if(kernel)
+    {
+        QBENCHMARK {
+            same = contentHash(image) == hash;
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            same = image == kept;
+        }
+    }
+    QVERIFY(same);
+}
+
+QTEST_MAIN(TestImageDiff)
+#include "tst_image_diff.moc"
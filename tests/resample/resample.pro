@@ -0,0 +1,9 @@
+QT = core gui concurrent testlib
+CONFIG += testcase warn_on
+TARGET = tst_resample
+INCLUDEPATH += ../..
+
+HEADERS += ../../constants.h \
+    ../../resample.h
+SOURCES += tst_resample.cpp \
+    ../../resample.cpp
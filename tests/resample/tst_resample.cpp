@@ -0,0 +1,114 @@
+#include <QtTest>
+
+#include "resample.h"
+
+
+/**
+ * Resampler against QImage::scaled, enlarging and shrinking a photo sized
+ * image with each filter.
+ */
+class TestResample : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void scaleSpeed_data();
+    void scaleSpeed();
+};
+
+/** scaled with QImage::scaled rather than a Resampler filter */
+static const int QIMAGE_SCALED = -1;
+
+/**
+ * @brief photo - An image with smooth gradients and sharp edges, so every
+ *                filter has some work to do
+ *
+ */
+static QImage photo(const QSize &size)
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    QRandomGenerator random(3);
+    for(int y = 0; y < image.height(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for(int x = 0; x < image.width(); ++x)
+        {
+            int noise = random.bounded(16);
+            line[x] = qRgb((x * 255 / image.width() + noise) & 0xff,
+                           (y * 255 / image.height() + noise) & 0xff,
+                           ((x / 64 + y / 64) % 2) * 255);
+        }
+    }
+    return image;
+}
+
+/**
+ * @brief TestResample::scaleSpeed_data - Each filter, and QImage::scaled
+ *                                        both fast and smooth, doubling a
+ *                                        720p image to 1440p, halving it
+ *                                        back, and shrinking it to a
+ *                                        thumbnail
+ *
+ */
+void TestResample::scaleSpeed_data()
+{
+    QTest::addColumn<QSize>("from");
+    QTest::addColumn<QSize>("to");
+    QTest::addColumn<int>("filter");
+    QTest::addColumn<int>("mode");
+
+    QList<QPair<QSize, QSize> > sizes;
+    sizes << qMakePair(QSize(1280, 720), QSize(2560, 1440))
+          << qMakePair(QSize(2560, 1440), QSize(1280, 720))
+          << qMakePair(QSize(2560, 1440), QSize(256, 144));
+
+    const char *filters[] = { "nearest", "bilinear", "bicubic", "lanczos3" };
+
+    for(int i = 0; i < sizes.size(); ++i)
+    {
+        QSize from = sizes.at(i).first, to = sizes.at(i).second;
+        QString name = QString("%1x%2 to %3x%4, ").arg(from.width())
+                       .arg(from.height()).arg(to.width()).arg(to.height());
+
+        for(int filter = nearest_filter; filter <= lanczos3_filter; ++filter)
+            QTest::newRow(qPrintable(name + filters[filter]))
+                << from << to << filter << 0;
+
+        QTest::newRow(qPrintable(name + "QImage fast"))
+            << from << to << QIMAGE_SCALED << int(Qt::FastTransformation);
+        QTest::newRow(qPrintable(name + "QImage smooth"))
+            << from << to << QIMAGE_SCALED << int(Qt::SmoothTransformation);
+    }
+}
+
+/**
+ * @brief TestResample::scaleSpeed - Resizes the image the row asks for
+ *
+ */
+void TestResample::scaleSpeed()
+{
+    QFETCH(QSize, from);
+    QFETCH(QSize, to);
+    QFETCH(int, filter);
+    QFETCH(int, mode);
+
+    QImage image = photo(from);
+    QImage result;
+    if(filter == QIMAGE_SCALED)
+    {
+        QBENCHMARK {
+            result = image.scaled(to, Qt::IgnoreAspectRatio,
+                                  Qt::TransformationMode(mode));
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            result = Resampler::scaled(image, to, ResizeFilter(filter));
+        }
+    }
+    QCOMPARE(result.size(), to);
+}
+
+QTEST_MAIN(TestResample)
+#include "tst_resample.moc"
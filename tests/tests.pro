@@ -0,0 +1,6 @@
+TEMPLATE = subdirs
+SUBDIRS += \
+    bmp_reader \
+    canvas_painter \
+    image_diff \
+    resample
@@ -1,9 +1,48 @@
 #include <QPainter>
 
 #include "tool.h"
-#include "draw_area.h"
+#include "canvas.h"
 
 
+/**
+ * @brief Tool::beginStroke - Give the stroke's painter this tool's pen
+ *
+ */
+void Tool::beginStroke(CanvasPainter *painter)
+{
+    painter->setPen(static_cast<QPen>(*this));
+}
+
+/**
+ * @brief Tool::drawThrough - Draws to each point in turn
+ *
+ */
+QRect Tool::drawThrough(const QPolygon &points, CanvasPainter *painter)
+{
+    QRect area;
+    for(int i = 0; i < points.size(); ++i)
+        area |= drawTo(points[i], painter);
+    return area;
+}
+
+/**
+ * @brief PenTool::beginStroke - Batches of moves are drawn as polylines,
+ *                               so pick joins that look like the caps of
+ *                               separate segments would have
+ *
+ */
+void PenTool::beginStroke(CanvasPainter *painter)
+{
+    QPen pen = static_cast<QPen>(*this);
+    switch(capStyle())
+    {
+        case Qt::RoundCap: pen.setJoinStyle(Qt::RoundJoin);   break;
+        case Qt::SquareCap: pen.setJoinStyle(Qt::MiterJoin);  break;
+        default: pen.setJoinStyle(Qt::BevelJoin);             break;
+    }
+    painter->setPen(pen);
+}
+
 /**
  * @brief PenTool::drawTo - Draws line from startPoint to endPoint, where
  *                          startpoint is either:
@@ -13,19 +52,66 @@
  *
  *                          -endPoint is where the mouse was moved TO on this event.
  *
+ *                          Returns the area drawn on during the stroke.
+ *
  */
-void PenTool::drawTo(const QPoint &endPoint, DrawArea *drawArea, QPixmap *image)
+QRect PenTool::drawTo(const QPoint &endPoint, CanvasPainter *painter)
 {
-    QPainter painter(image);
-    painter.setPen(static_cast<QPen>(*this));
-    painter.drawLine(getStartPoint(), endPoint);
-
-    // speed things up a bit by only updating the immediate
-    // radius of the DrawArea
-    int rad = (this->width() / 2) + 2;
-    drawArea->update(QRect(getStartPoint(), endPoint).normalized()
-                                .adjusted(-rad, -rad, +rad, +rad));
+    QPolygon line;
+    line << getStartPoint() << endPoint;
+    drawLine(line, painter);
     setStartPoint(endPoint);
+    return painter->paintedArea();
+}
+
+/**
+ * @brief PenTool::drawThrough - Draws from startPoint through each of the
+ *                               points as one polyline, so a batch of mouse
+ *                               moves costs one call and one repaint
+ *
+ */
+QRect PenTool::drawThrough(const QPolygon &points, CanvasPainter *painter)
+{
+    if(points.size() == 1)
+        return drawTo(points[0], painter);
+
+    QPolygon line(points.size() + 1);
+    line[0] = getStartPoint();
+    for(int i = 0; i < points.size(); ++i)
+        line[i + 1] = points[i];
+
+    drawLine(line, painter);
+    setStartPoint(points.last());
+    return painter->paintedArea();
+}
+
+/**
+ * @brief PenTool::stamps - Whether the pen is drawn with the brush engine.
+ *                          A dab has no direction, so it can't end a line
+ *                          flat; those are left to QPainter, as are pens
+ *                          with a dash pattern. A 1px pen is left to the
+ *                          canvas painter, which writes its pixels directly.
+ *
+ */
+bool PenTool::stamps() const
+{
+    return style() == Qt::SolidLine && capStyle() != Qt::FlatCap &&
+           widthF() > 1;
+}
+
+/**
+ * @brief PenTool::drawLine - Draws through the points of the line, by
+ *                            stamping dabs or stroking it
+ *
+ */
+void PenTool::drawLine(const QPolygon &line, CanvasPainter *painter)
+{
+    if(stamps())
+        painter->stampPolyline(line, spacing);
+    else if(line.size() == 2)
+        painter->drawLine(line[0], line[1]);
+    else
+        painter->drawPolyline(line);
 }
 
 /**
@@ -33,13 +119,58 @@ void PenTool::drawTo(const QPoint &endPoint, DrawArea *drawArea, QPixmap *image)
  *                           -startpoint is where mouse was clicked, and
  *                           -endPoint is where the mouse was released
  *
+ *                           Returns the area drawn on during the stroke.
+ *
  */
-void LineTool::drawTo(const QPoint &endPoint,  DrawArea *drawArea, QPixmap *image)
+QRect LineTool::drawTo(const QPoint &endPoint, CanvasPainter *painter)
+{
+    drawShape(*painter, endPoint);
+    return painter->paintedArea();
+}
+
+/**
+ * @brief LineTool::drawPreview - Draws the line being dragged out straight
+ *                                onto the widget, leaving the image alone
+ *
+ */
+void LineTool::drawPreview(QPainter *painter, const QPoint &endPoint)
+{
+    painter->setPen(static_cast<QPen>(*this));
+    drawShape(*painter, endPoint);
+}
+
+/**
+ * @brief LineTool::previewBounds - The area the line covers, including
+ *                                  its width and caps
+ *
+ */
+QRect LineTool::previewBounds(const QPoint &endPoint) const
+{
+    return CanvasPainter::strokeBounds(QRect(getStartPoint(), endPoint), *this);
+}
+
+/**
+ * @brief LineTool::drawShape - Draws the line with either a QPainter or
+ *                              a CanvasPainter, already given the pen
+ *
+ */
+template<class Painter>
+void LineTool::drawShape(Painter &painter, const QPoint &endPoint)
 {
-    QPainter painter(image);
-    painter.setPen(static_cast<QPen>(*this));
     painter.drawLine(getStartPoint(), endPoint);
-    drawArea->update();
+}
+
+/**
+ * @brief FillTool::drawTo - Fills the area around the point clicked with
+ *                           the tool's color
+ *
+ *                           Returns the area filled.
+ *
+ */
+QRect FillTool::drawTo(const QPoint &point, CanvasPainter *painter)
+{
+    painter->floodFill(point, color(), tolerance);
+    return painter->paintedArea();
 }
 
 /**
@@ -62,14 +193,69 @@ RectTool::RectTool(const QBrush &brush, qreal width, Qt::PenStyle s,
  *                           -startpoint is where mouse was clicked, and
  *                           -endPoint is where the mouse was released
  *
+ *                           Returns the area drawn on during the stroke.
+ *
  */
-void RectTool::drawTo(const QPoint &endPoint,  DrawArea *drawArea, QPixmap *image)
+QRect RectTool::drawTo(const QPoint &endPoint, CanvasPainter *painter)
+{
+    drawShape(*painter, endPoint);
+    return painter->paintedArea();
+}
+
+/**
+ * @brief RectTool::beginStroke - Give the stroke's painter the outline pen
+ *                                and the fill
+ *
+ */
+void RectTool::beginStroke(CanvasPainter *painter)
+{
+    setUp(*painter);
+}
+
+/**
+ * @brief RectTool::drawPreview - Draws the shape being dragged out straight
+ *                                onto the widget, leaving the image alone
+ *
+ */
+void RectTool::drawPreview(QPainter *painter, const QPoint &endPoint)
+{
+    setUp(*painter);
+    drawShape(*painter, endPoint);
+}
+
+/**
+ * @brief RectTool::previewBounds - The area the shape covers, including
+ *                                  its outline and corners
+ *
+ */
+QRect RectTool::previewBounds(const QPoint &endPoint) const
+{
+    return CanvasPainter::strokeBounds(adjustPoints(endPoint), *this);
+}
+
+/**
+ * @brief RectTool::setUp - Pen for the outline, and a brush if filled
+ *
+ */
+template<class Painter>
+void RectTool::setUp(Painter &painter) const
 {
-    QPainter painter(image);
     painter.setPen(static_cast<QPen>(*this));
+    if(fillMode != no_fill)
+        painter.setBrush(QBrush(fillColor));
+}
+
+/**
+ * @brief RectTool::drawShape - Draws a rectangle, square, or ellipse--fill
+ *                              or no fill--based on settings, with either
+ *                              a QPainter or a CanvasPainter that was set up
+ *
+ */
+template<class Painter>
+void RectTool::drawShape(Painter &painter, const QPoint &endPoint)
+{
     QRect rect = adjustPoints(endPoint);
 
-    //draw a rectangle, square, or ellipse--fill or no fill--based on settings
     switch(shapeType)
     {
         case rectangle:
@@ -80,21 +266,16 @@ void RectTool::drawTo(const QPoint &endPoint,  DrawArea *drawArea, QPixmap *imag
         } break;
         case rounded_rectangle:
         {
-            if(fillMode != no_fill)
-                painter.setBrush(QBrush(fillColor));
             painter.drawRoundedRect(rect, roundedCurve, roundedCurve,
                                           Qt::RelativeSize); break;
         }
         case ellipse:
         {
-            if(fillMode != no_fill)
-                painter.setBrush(QBrush(fillColor));
             painter.drawEllipse(rect);
         } break;
         default:
           break;
     }
-    drawArea->update();
 }
 
 /**
@@ -102,7 +283,7 @@ void RectTool::drawTo(const QPoint &endPoint,  DrawArea *drawArea, QPixmap *imag
  *                                 a rectangle
  *
  */
-QRect RectTool::adjustPoints(const QPoint &endPoint)
+QRect RectTool::adjustPoints(const QPoint &endPoint) const
 {
     // 'top left' and 'bottom right' are relative, so we may need to
     // switch the points
@@ -3,11 +3,13 @@
 
 #include <QWidget>
 #include <QPen>
+#include <QPolygon>
 
 #include "constants.h"
 
 
-class DrawArea;
+class CanvasPainter;
+class QPainter;
 
 class Tool : public QPen
 {
@@ -19,7 +21,19 @@ public:
     virtual ~Tool() {}
 
     virtual ToolType getType() const = 0;
-    virtual void drawTo(const QPoint&, DrawArea*, QPixmap*) {}
+
+    /** a stroke keeps one painter from press to release; its pen and brush
+     *  are set up once, here */
+    virtual void beginStroke(CanvasPainter*);
+    virtual QRect drawTo(const QPoint&, CanvasPainter*) { return QRect(); }
+
+    /** draw to each of several points in turn, e.g. a frame's worth of
+     *  mouse moves; tools that can do it in one go override this */
+    virtual QRect drawThrough(const QPolygon&, CanvasPainter*);
+
+    /** the shape being dragged out, drawn over the canvas until release */
+    virtual void drawPreview(QPainter*, const QPoint&) {}
+    virtual QRect previewBounds(const QPoint&) const { return QRect(); }
 
     QPoint getStartPoint() const { return startPoint; }
     void setStartPoint(QPoint point) { startPoint = point; }
@@ -38,12 +52,25 @@ public:
     PenTool(const QBrush &brush, qreal width, Qt::PenStyle s = Qt::SolidLine,
             Qt::PenCapStyle c = Qt::RoundCap,
             Qt::PenJoinStyle j = Qt::BevelJoin)
-       : Tool(brush, width, s, c, j) {}
+       : Tool(brush, width, s, c, j), spacing(DEFAULT_DAB_SPACING) {}
 
     virtual ToolType getType() const { return pen; }
-    virtual void drawTo(const QPoint&, DrawArea*, QPixmap*);
+    virtual void beginStroke(CanvasPainter*);
+    virtual QRect drawTo(const QPoint&, CanvasPainter*);
+    virtual QRect drawThrough(const QPolygon&, CanvasPainter*);
+
+    /** distance between dabs, as a fraction of the width */
+    qreal getSpacing() const { return spacing; }
+    void setSpacing(qreal value) { spacing = value; }
 
 private:
+    /** round & square caps are drawn by stamping dabs, flat ones and 1px
+     *  pens as lines */
+    bool stamps() const;
+    void drawLine(const QPolygon&, CanvasPainter*);
+
+    qreal spacing;
+
     /** Don't allow copying */
     PenTool(const PenTool&);
     PenTool& operator=(const PenTool&);
@@ -57,9 +84,13 @@ public:
              Qt::PenJoinStyle j = Qt::BevelJoin)
        : Tool(brush, width, s, c, j) {}
     virtual ToolType getType() const { return line; }
-    virtual void drawTo(const QPoint&, DrawArea*, QPixmap*);
+    virtual QRect drawTo(const QPoint&, CanvasPainter*);
+    virtual void drawPreview(QPainter*, const QPoint&);
+    virtual QRect previewBounds(const QPoint&) const;
 
 private:
+    template<class Painter> void drawShape(Painter&, const QPoint&);
+
     /** Don't allow copying */
     LineTool(const LineTool&);
     LineTool& operator=(const LineTool&);
@@ -82,6 +113,28 @@ private:
     EraserTool& operator=(const EraserTool&);
 };
 
+class FillTool : public Tool
+{
+public:
+    FillTool(const QBrush &brush, int tolerance = DEFAULT_FILL_TOLERANCE)
+       : Tool(brush, 1), tolerance(tolerance) {}
+
+    virtual ToolType getType() const { return fill_tool; }
+    virtual QRect drawTo(const QPoint&, CanvasPainter*);
+
+    /** how far (0-255, per channel) a pixel may be from the one clicked
+     *  and still be filled */
+    int getTolerance() const { return tolerance; }
+    void setTolerance(int value) { tolerance = value; }
+
+private:
+    int tolerance;
+
+    /** Don't allow copying */
+    FillTool(const FillTool&);
+    FillTool& operator=(const FillTool&);
+};
+
 class RectTool : public Tool
 {
 public:
@@ -94,16 +147,22 @@ public:
              int roundedCurve = DEFAULT_RECT_CURVE);
 
     virtual ToolType getType() const { return rect_tool; }
-    virtual void drawTo(const QPoint&, DrawArea*, QPixmap*);
+    virtual void beginStroke(CanvasPainter*);
+    virtual QRect drawTo(const QPoint&, CanvasPainter*);
+    virtual void drawPreview(QPainter*, const QPoint&);
+    virtual QRect previewBounds(const QPoint&) const;
 
     FillColor getFillMode() const { return fillMode; }
     void setFillMode(FillColor mode) { fillMode = mode; }
     void setShapeType(ShapeType shape) { shapeType = shape; }
     void setFillColor(QColor color) { fillColor = color; }
     void setCurve(int value) { roundedCurve = value; }
-    QRect adjustPoints(const QPoint&);
+    QRect adjustPoints(const QPoint&) const;
 
 private:
+    template<class Painter> void setUp(Painter&) const;
+    template<class Painter> void drawShape(Painter&, const QPoint&);
+
     ShapeType shapeType;
     QColor fillColor;
     FillColor fillMode;
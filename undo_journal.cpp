@@ -0,0 +1,202 @@
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+
+#include "undo_journal.h"
+
+
+/** rewrite the journal once this much of it is dead and it outweighs the rest */
+static const qint64 COMPACT_THRESHOLD = 64 * 1024 * 1024;
+
+/**
+ * @brief UndoJournal::UndoJournal - The file isn't created until the first
+ *                                   record is appended
+ */
+UndoJournal::UndoJournal()
+{
+    file = 0;
+    map = 0;
+    mapSize = 0;
+    live = 0;
+    dead = 0;
+    lastPageIn = 0;
+    totalPageIn = 0;
+    pageIns = 0;
+}
+
+UndoJournal::~UndoJournal()
+{
+    unmap();
+    delete file;
+}
+
+/**
+ * @brief UndoJournal::append - Write a record to the end of the journal
+ */
+int UndoJournal::append(const QByteArray &data)
+{
+    if(!file && !open())
+        return -1;
+
+    Record record;
+    record.offset = file->size();
+    record.size = data.size();
+
+    if(!file->seek(record.offset) ||
+            file->write(data) != data.size())
+        return -1;
+
+    records.append(record);
+    live += record.size;
+    return records.size() - 1;
+}
+
+/**
+ * @brief UndoJournal::read - Page a record back in through the memory map
+ */
+QByteArray UndoJournal::read(int record)
+{
+    const Record &r = records.at(record);
+    if(r.size < 0)
+        return QByteArray();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // records appended since the last read aren't mapped yet
+    QByteArray data;
+    if(r.offset + r.size <= mapSize || remap())
+    {
+        data = QByteArray(reinterpret_cast<const char*>(map + r.offset), r.size);
+    }
+    else if(file->seek(r.offset))
+    {
+        data = file->read(r.size);
+    }
+
+    lastPageIn = timer.nsecsElapsed() / 1000;
+    totalPageIn += lastPageIn;
+    ++pageIns;
+    return data;
+}
+
+/**
+ * @brief UndoJournal::release - Mark a record as no longer needed. Its
+ *                               space is reclaimed by the next compaction.
+ */
+void UndoJournal::release(int record)
+{
+    Record &r = records[record];
+    if(r.size < 0)
+        return;
+
+    live -= r.size;
+    dead += r.size;
+    r.size = -1;
+
+    if(dead > COMPACT_THRESHOLD && dead > live)
+        compact();
+}
+
+/**
+ * @brief UndoJournal::fileSize - Size of the journal on disk
+ */
+qint64 UndoJournal::fileSize() const
+{
+    return file ? file->size() : 0;
+}
+
+/**
+ * @brief UndoJournal::averagePageInTime - Mean time of every page-in so far
+ */
+qint64 UndoJournal::averagePageInTime() const
+{
+    return pageIns ? totalPageIn / pageIns : 0;
+}
+
+/**
+ * @brief UndoJournal::open - Create the journal in the temp directory
+ */
+bool UndoJournal::open()
+{
+    file = new QTemporaryFile(QDir::tempPath() + "/paint_undo_XXXXXX.journal");
+    if(!file->open())
+    {
+        delete file;
+        file = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief UndoJournal::remap - Map the whole file, including new records
+ */
+bool UndoJournal::remap()
+{
+    unmap();
+    if(!file->flush())
+        return false;
+
+    mapSize = file->size();
+    map = file->map(0, mapSize);
+    if(!map)
+        mapSize = 0;
+    return map != 0;
+}
+
+/**
+ * @brief UndoJournal::unmap - Drop the current mapping, if any
+ */
+void UndoJournal::unmap()
+{
+    if(map)
+        file->unmap(map);
+    map = 0;
+    mapSize = 0;
+}
+
+/**
+ * @brief UndoJournal::compact - Copy the live records into a fresh file,
+ *                               leaving the released ones behind
+ */
+void UndoJournal::compact()
+{
+    QTemporaryFile *oldFile = file;
+    file = 0;
+    if(!open())
+    {
+        file = oldFile;
+        return;
+    }
+
+    QVector<qint64> offsets(records.size());
+    qint64 offset = 0;
+    for(int i = 0; i < records.size(); ++i)
+    {
+        const Record &r = records.at(i);
+        if(r.size < 0)
+            continue;
+
+        if(!oldFile->seek(r.offset) ||
+                file->write(oldFile->read(r.size)) != r.size)
+        {
+            // leave things as they were
+            delete file;
+            file = oldFile;
+            return;
+        }
+        offsets[i] = offset;
+        offset += r.size;
+    }
+
+    for(int i = 0; i < records.size(); ++i)
+        records[i].offset = offsets.at(i);
+
+    if(map)
+        oldFile->unmap(map);
+    map = 0;
+    mapSize = 0;
+    delete oldFile;
+    dead = 0;
+}
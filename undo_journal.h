@@ -0,0 +1,62 @@
+#ifndef UNDO_JOURNAL_H
+#define UNDO_JOURNAL_H
+
+#include <QByteArray>
+#include <QVector>
+
+
+class QTemporaryFile;
+
+/**
+ * An append-only scratch file that holds undo data paged out of memory.
+ * Records are read back through a memory map when they are needed again.
+ */
+class UndoJournal
+{
+public:
+    UndoJournal();
+    ~UndoJournal();
+
+    /** store a record, returns its id or -1 on failure */
+    int append(const QByteArray &data);
+    QByteArray read(int record);
+    void release(int record);
+
+    /** statistics */
+    qint64 fileSize() const;
+    qint64 liveBytes() const { return live; }
+    qint64 lastPageInTime() const { return lastPageIn; }
+    qint64 averagePageInTime() const;
+
+private:
+    bool open();
+    bool remap();
+    void unmap();
+    void compact();
+
+    struct Record
+    {
+        qint64 offset;
+        int size;
+    };
+
+    QTemporaryFile* file;
+    uchar* map;
+    qint64 mapSize;
+
+    /** released records have a size of -1 */
+    QVector<Record> records;
+    qint64 live;
+    qint64 dead;
+
+    /** page-in latency, in microseconds */
+    qint64 lastPageIn;
+    qint64 totalPageIn;
+    int pageIns;
+
+    /** Don't allow copying */
+    UndoJournal(const UndoJournal&);
+    UndoJournal& operator=(const UndoJournal&);
+};
+
+#endif // UNDO_JOURNAL_H